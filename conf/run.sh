@@ -14,18 +14,7 @@ PATH=../build:$PATH
 
 TRACKER=tracker
 TRACK=track.yaml
-OPTS="-u -r"
-
-$TRACKER -t $TRACK $OPTS -c lb-calib.yaml -v 0 &
-sleep 1
-$TRACKER -t $TRACK $OPTS -c lt-calib.yaml -v 1 &
-sleep 1
-$TRACKER -t $TRACK $OPTS -c mb-calib.yaml -v 2 &
-sleep 1
-$TRACKER -t $TRACK $OPTS -c mt-calib.yaml -v 3 &
-sleep 1
-$TRACKER -t $TRACK $OPTS -c rb-calib.yaml -v 4 &
-sleep 1
-$TRACKER -t $TRACK $OPTS -c rt-calib.yaml -v 5 &
-
+OPTS="-u -r -F 10"
 
+# all cameras are tracked by a single process (see cameras.txt)
+$TRACKER -t $TRACK $OPTS -m cameras.txt &
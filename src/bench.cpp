@@ -0,0 +1,472 @@
+#include <unistd.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <iostream>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/objdetect/objdetect.hpp"
+#include "calib.hpp"
+#include "track.hpp"
+
+using namespace std;
+using namespace cv;
+
+/*
+ * Every heap allocation of the process, OpenCV's included, is routed through
+ * these wrappers so that the benchmark can count allocations per frame.
+ */
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t align, size_t size);
+void __libc_free(void *ptr);
+}
+
+static volatile long allocations = 0;
+
+extern "C" {
+void *malloc(size_t size) {
+	__sync_fetch_and_add(&allocations, 1);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+	__sync_fetch_and_add(&allocations, 1);
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	__sync_fetch_and_add(&allocations, 1);
+	return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t align, size_t size) {
+	__sync_fetch_and_add(&allocations, 1);
+	return __libc_memalign(align, size);
+}
+
+int posix_memalign(void **ptr, size_t align, size_t size) {
+	__sync_fetch_and_add(&allocations, 1);
+	*ptr = __libc_memalign(align, size);
+	return *ptr == NULL ? 12 /* ENOMEM */ : 0;
+}
+
+void free(void *ptr) {
+	__libc_free(ptr);
+}
+}
+
+void help() {
+	cout << "Usage: calibtool_bench [option]*" << endl
+	     << "Description:" << endl
+	     << "  Times the hot paths of the calib and track libraries against the" << endl
+	     << "  frames and calibration files checked into conf/." << endl
+	     << "Options:" << endl
+	     << "  -d <dir>     fixture directory (default ../conf)" << endl
+	     << "  -h           this help info" << endl
+	     << "  -n <iters>   passes over the fixture frames per measurement (default 5)" << endl
+	     << "  -s <stage>   only run one stage (grayblur, canny, hough, detector," << endl
+	     << "               group, world, compare)" << endl
+;
+}
+
+const char *cameras[] = { "lb", "lt", "mb", "mt", "rb", "rt" };
+const int numCameras = sizeof(cameras) / sizeof(cameras[0]);
+const double scales[] = { 0.25, 0.5, 1.0 };
+const int numScales = sizeof(scales) / sizeof(scales[0]);
+
+long long nanos() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Accumulates time and allocations over the measured calls only.
+ */
+struct Sample {
+	long long ns;
+	long allocs;
+	long frames;
+	long long startNs;
+	long startAllocs;
+
+	Sample() : ns(0), allocs(0), frames(0), startNs(0), startAllocs(0) {}
+
+	void start() {
+		startAllocs = allocations;
+		startNs = nanos();
+	}
+
+	void stop() {
+		ns += nanos() - startNs;
+		allocs += allocations - startAllocs;
+		frames++;
+	}
+};
+
+void header() {
+	printf("%-10s %-34s %10s %14s %12s\n", "stage", "variant", "size", "ns/frame", "allocs/frame");
+}
+
+void report(string stage, string variant, Size size, const Sample &s) {
+	char dim[32];
+	snprintf(dim, sizeof(dim), "%dx%d", size.width, size.height);
+	long frames = s.frames > 0 ? s.frames : 1;
+	printf("%-10s %-34s %10s %14.0f %12.1f\n", stage.c_str(), variant.c_str(), dim,
+	       (double)s.ns / frames, (double)s.allocs / frames);
+}
+
+/*
+ * Loads the checked-in camera frames, rescaled to each benchmark size.
+ */
+bool loadFrames(string dir, vector<vector<Mat> > *frames) {
+	frames->resize(numScales);
+	for (int c = 0; c < numCameras; c++) {
+		string file = dir + "/" + cameras[c] + ".jpg";
+		Mat img = imread(file, 1);
+		if (img.empty()) {
+			cout << "Cannot read fixture frame: " << file << endl;
+			return false;
+		}
+		for (int s = 0; s < numScales; s++) {
+			Mat scaled;
+			resize(img, scaled, Size(), scales[s], scales[s], INTER_AREA);
+			(*frames)[s].push_back(scaled);
+		}
+	}
+	return true;
+}
+
+void benchGrayblur(const vector<vector<Mat> > &frames, const track::Config &conf, int iters) {
+	for (int s = 0; s < numScales; s++) {
+		Sample sample;
+		Mat work;
+		for (int it = 0; it < iters; it++) {
+			for (size_t f = 0; f < frames[s].size(); f++) {
+				frames[s][f].copyTo(work);
+				sample.start();
+				track::grayblur(&work, conf.blurSize, conf.blurSigma);
+				sample.stop();
+			}
+		}
+		report("grayblur", "track.yaml", frames[s][0].size(), sample);
+	}
+}
+
+void benchCanny(const vector<vector<Mat> > &frames, const track::Config &conf, int iters) {
+	for (int s = 0; s < numScales; s++) {
+		vector<Mat> gray(frames[s].size());
+		for (size_t f = 0; f < frames[s].size(); f++) {
+			frames[s][f].copyTo(gray[f]);
+			track::grayblur(&gray[f], conf.blurSize, conf.blurSigma);
+		}
+
+		Sample sample;
+		Mat work;
+		for (int it = 0; it < iters; it++) {
+			for (size_t f = 0; f < gray.size(); f++) {
+				gray[f].copyTo(work);
+				sample.start();
+				track::canny(&work, conf.cannyThresh);
+				sample.stop();
+			}
+		}
+		report("canny", "track.yaml", frames[s][0].size(), sample);
+	}
+}
+
+void benchHough(const vector<vector<Mat> > &frames, const track::Config &conf, int iters) {
+	// the configured radius band and accumulator threshold, then variations
+	struct Variant { const char *name; double minR; double maxR; double acc; };
+	const Variant variants[] = {
+		{ "track.yaml",        1.0, 1.0, 1.0 },
+		{ "acc x0.5",          1.0, 1.0, 0.5 },
+		{ "acc x2",            1.0, 1.0, 2.0 },
+		{ "radius band x0.5",  1.25, 0.875, 1.0 },
+	};
+	const int numVariants = sizeof(variants) / sizeof(variants[0]);
+
+	for (int v = 0; v < numVariants; v++) {
+		for (int s = 0; s < numScales; s++) {
+			int minR = cvRound(conf.minRadius * variants[v].minR * scales[s]);
+			int maxR = cvRound(conf.maxRadius * variants[v].maxR * scales[s]);
+			double acc = conf.accThresh * variants[v].acc;
+
+			Sample sample;
+			vector<Vec3f> circles;
+			for (int it = 0; it < iters; it++) {
+				for (size_t f = 0; f < frames[s].size(); f++) {
+					sample.start();
+					track::detectCircles(frames[s][f], &circles, conf.blurSize, conf.blurSigma,
+					                     minR, maxR, conf.cannyThresh, acc);
+					sample.stop();
+				}
+			}
+			char variant[64];
+			snprintf(variant, sizeof(variant), "%s r=%d..%d acc=%.0f", variants[v].name, minR, maxR, acc);
+			report("hough", variant, frames[s][0].size(), sample);
+		}
+	}
+
+	// the band engine on the configured settings
+	for (int s = 0; s < numScales; s++) {
+		track::Config band = conf;
+		band.engine = track::ENGINE_BAND;
+		band.minRadius = cvRound(conf.minRadius * scales[s]);
+		band.maxRadius = cvRound(conf.maxRadius * scales[s]);
+
+		track::Detector detector(band);
+		Sample sample;
+		for (int it = 0; it < iters; it++) {
+			for (size_t f = 0; f < frames[s].size(); f++) {
+				sample.start();
+				detector.detect(frames[s][f]);
+				sample.stop();
+			}
+		}
+		char variant[64];
+		snprintf(variant, sizeof(variant), "band engine r=%d..%d acc=%.0f", band.minRadius, band.maxRadius,
+		         band.accThresh);
+		report("hough", variant, frames[s][0].size(), sample);
+	}
+}
+
+/*
+ * The whole detector as tracker runs it, one per camera, in steady state
+ * after a warm-up frame. Allocations here come from inside OpenCV.
+ */
+void benchDetector(const vector<vector<Mat> > &frames, const track::Config &conf, int iters) {
+	const track::Engine engines[] = { track::ENGINE_OPENCV, track::ENGINE_BAND };
+	const char *names[] = { "opencv engine", "band engine" };
+
+	for (int e = 0; e < 2; e++) {
+		for (int s = 0; s < numScales; s++) {
+			track::Config scaled = conf;
+			scaled.engine = engines[e];
+			scaled.minRadius = cvRound(conf.minRadius * scales[s]);
+			scaled.maxRadius = cvRound(conf.maxRadius * scales[s]);
+			scaled.roiPadding = cvRound(conf.roiPadding * scales[s]);
+
+			vector<track::Detector> detectors(frames[s].size());
+			for (size_t f = 0; f < frames[s].size(); f++) {
+				detectors[f].configure(scaled);
+				detectors[f].detect(frames[s][f]);
+			}
+
+			Sample sample;
+			for (int it = 0; it < iters; it++) {
+				for (size_t f = 0; f < frames[s].size(); f++) {
+					sample.start();
+					detectors[f].detect(frames[s][f]);
+					sample.stop();
+				}
+			}
+			report("detector", names[e], frames[s][0].size(), sample);
+		}
+	}
+}
+
+/*
+ * Compares the circles found by the band engine with those of HoughCircles.
+ */
+void compareEngines(const vector<vector<Mat> > &frames, const track::Config &conf) {
+	track::Config opencv = conf;
+	opencv.engine = track::ENGINE_OPENCV;
+	opencv.roiPadding = 0;
+	opencv.pyramidScale = 1;
+	track::Config band = opencv;
+	band.engine = track::ENGINE_BAND;
+	track::Detector reference(opencv), detector(band);
+	const vector<Mat> &full = frames[numScales - 1];
+
+	printf("%-8s %8s %8s %8s %12s %12s\n", "frame", "opencv", "band", "matched", "centre err", "radius err");
+	for (size_t f = 0; f < full.size(); f++) {
+		const vector<Vec3f> &expected = reference.detect(full[f], false);
+		const vector<Vec3f> &circles = detector.detect(full[f], false);
+
+		int matched = 0;
+		double centreErr = 0, radiusErr = 0;
+		for (size_t i = 0; i < expected.size(); i++) {
+			int best = -1;
+			double bestD2 = conf.minRadius * conf.minRadius / 4.0;
+			for (size_t j = 0; j < circles.size(); j++) {
+				double ddx = circles[j][0] - expected[i][0];
+				double ddy = circles[j][1] - expected[i][1];
+				if (ddx*ddx + ddy*ddy < bestD2) {
+					bestD2 = ddx*ddx + ddy*ddy;
+					best = j;
+				}
+			}
+			if (best < 0)
+				continue;
+			matched++;
+			centreErr += sqrt(bestD2);
+			radiusErr += fabs(circles[best][2] - expected[i][2]);
+		}
+		printf("%-8s %8lu %8lu %8d %12.2f %12.2f\n", cameras[f], (unsigned long)expected.size(),
+		       (unsigned long)circles.size(), matched, matched ? centreErr / matched : 0.0,
+		       matched ? radiusErr / matched : 0.0);
+	}
+}
+
+void benchGroup(const vector<vector<Mat> > &frames, const track::Config &conf, int iters) {
+	for (int s = 0; s < numScales; s++) {
+		// the raw circles tracker hands to the clustering
+		vector<vector<Vec3f> > raw(frames[s].size());
+		vector<vector<Rect> > rawRects(frames[s].size());
+		size_t total = 0;
+		for (size_t f = 0; f < frames[s].size(); f++) {
+			track::detectCircles(frames[s][f], &raw[f], conf.blurSize, conf.blurSigma,
+			                     cvRound(conf.minRadius * scales[s]), cvRound(conf.maxRadius * scales[s]),
+			                     conf.cannyThresh, conf.accThresh);
+			for (size_t i = 0; i < raw[f].size(); i++)
+				rawRects[f].push_back(Rect(raw[f][i][0], raw[f][i][1], raw[f][i][2], raw[f][i][2]));
+			total += raw[f].size();
+		}
+
+		// the groupRectangles workaround tracker used before
+		Sample sample;
+		vector<Rect> rects;
+		size_t groups = 0;
+		for (int it = 0; it < iters; it++) {
+			for (size_t f = 0; f < raw.size(); f++) {
+				rects = rawRects[f];
+				sample.start();
+				cv::groupRectangles(rects, conf.groupMinSize - 1, 0.4);
+				sample.stop();
+				groups += rects.size();
+			}
+		}
+		char variant[64];
+		snprintf(variant, sizeof(variant), "groupRectangles n=%lu groups=%.1f",
+		         (unsigned long)(total / raw.size()), groups / (double)(iters * raw.size()));
+		report("group", variant, frames[s][0].size(), sample);
+
+		track::CircleGrouper grouper(conf.groupMinSize, conf.groupMergeDist * scales[s]);
+		vector<int> votes;
+		vector<Vec3f> circles;
+		Sample native;
+		groups = 0;
+		for (int it = 0; it < iters; it++) {
+			for (size_t f = 0; f < raw.size(); f++) {
+				native.start();
+				grouper.group(raw[f], votes, &circles);
+				native.stop();
+				groups += circles.size();
+			}
+		}
+		snprintf(variant, sizeof(variant), "CircleGrouper n=%lu groups=%.1f",
+		         (unsigned long)(total / raw.size()), groups / (double)(iters * raw.size()));
+		report("group", variant, frames[s][0].size(), native);
+	}
+}
+
+/*
+ * Compares the per-point calib::toWorld against the batch Calibration API.
+ */
+void benchToWorld(string dir, int iters) {
+	string calibfile = dir + "/" + cameras[0] + "-calib.yaml";
+	Mat convert = calib::loadCalib(calibfile);
+	calib::Calibration calibration;
+	if (!calibration.load(calibfile)) {
+		cout << "Cannot read calibration file: " << calibfile << endl;
+		return;
+	}
+
+	const int sizes[] = { 8, 64, 512 };
+	const int reps = 100;
+	for (int n = 0; n < 3; n++) {
+		int count = sizes[n];
+		vector<Point2f> pixels(count);
+		vector<Point2f> world(count);
+		RNG rng(count);
+		for (int i = 0; i < count; i++)
+			pixels[i] = Point2f(rng.uniform(0.f, 1600.f), rng.uniform(0.f, 1200.f));
+
+		Sample perPoint, batch, undistort;
+		for (int it = 0; it < iters * reps; it++) {
+			perPoint.start();
+			for (int i = 0; i < count; i++)
+				calib::toWorld(convert, pixels[i].x, pixels[i].y, &world[i].x, &world[i].y);
+			perPoint.stop();
+
+			batch.start();
+			calibration.toWorld(&pixels[0], &world[0], count);
+			batch.stop();
+
+			undistort.start();
+			calibration.toWorld(&pixels[0], &world[0], count, true);
+			undistort.stop();
+		}
+
+		char variant[64];
+		snprintf(variant, sizeof(variant), "per-point  n=%d", count);
+		report("world", variant, Size(1600, 1200), perPoint);
+		snprintf(variant, sizeof(variant), "batch      n=%d", count);
+		report("world", variant, Size(1600, 1200), batch);
+		snprintf(variant, sizeof(variant), "undistort  n=%d", count);
+		report("world", variant, Size(1600, 1200), undistort);
+	}
+}
+
+int main(int argc, char** argv) {
+	string dir = "../conf";
+	string stage;
+	int iters = 5;
+
+	int c;
+	while ((c = getopt(argc, argv, "hd:n:s:")) != -1) {
+		switch (c){
+		case 'd':
+			dir = string(optarg);
+			break;
+		case 'n':
+			iters = atoi(optarg);
+			break;
+		case 's':
+			stage = string(optarg);
+			break;
+		case 'h':
+			help();
+			return 0;
+		case '?':
+			cout << "Invalid arguments." << endl << endl;
+			help();
+			return 1;
+		}
+	}
+	if (iters < 1)
+		iters = 1;
+
+	track::Config conf;
+	if (!track::loadConfig(dir + "/track.yaml", &conf)) {
+		cout << "Cannot read tracker configuration file: " << dir << "/track.yaml" << endl;
+		return 1;
+	}
+	vector<vector<Mat> > frames;
+	if (!loadFrames(dir, &frames))
+		return 1;
+
+	header();
+	if (stage.empty() || stage == "grayblur")
+		benchGrayblur(frames, conf, iters);
+	if (stage.empty() || stage == "canny")
+		benchCanny(frames, conf, iters);
+	if (stage.empty() || stage == "hough")
+		benchHough(frames, conf, iters);
+	if (stage.empty() || stage == "detector")
+		benchDetector(frames, conf, iters);
+	if (stage.empty() || stage == "group")
+		benchGroup(frames, conf, iters);
+	if (stage.empty() || stage == "world")
+		benchToWorld(dir, iters);
+	if (stage.empty() || stage == "compare")
+		compareEngines(frames, conf);
+	return 0;
+}
@@ -0,0 +1,49 @@
+#include "opencv2/imgproc/imgproc.hpp"
+#include "blobs.hpp"
+
+using namespace std;
+using namespace cv;
+
+namespace track {
+
+BlobFinder::BlobFinder() : scale(4), threshold(0), minArea(0), maxArea(0), minSide(0) {
+}
+
+void BlobFinder::configure(int scale, double threshold, double minFill, double maxRobots, int minRadius,
+                           int maxRadius) {
+	this->scale = MAX(scale, 1);
+	this->threshold = threshold;
+	const double s2 = (double)this->scale * this->scale;
+	minArea = minFill * CV_PI * minRadius * minRadius / s2;
+	maxArea = maxRobots * CV_PI * maxRadius * maxRadius / s2;
+	// a robot half cut off still shows its full diameter along the edge
+	minSide = minRadius / (double)this->scale;
+}
+
+void BlobFinder::find(const Mat &img, vector<Rect> *candidates) {
+	candidates->clear();
+
+	Size area(MAX(img.cols / scale, 1), MAX(img.rows / scale, 1));
+	resize(img, small, area, 0, 0, INTER_AREA);
+	cvtColor(small, gray, CV_RGB2GRAY);
+	if (threshold > 0)
+		cv::threshold(gray, binary, threshold, 255, THRESH_BINARY);
+	else
+		cv::threshold(gray, binary, 0, 255, THRESH_BINARY | THRESH_OTSU);
+
+	// findContours overwrites its input; the outer outlines include the
+	// holes of the markers in their area
+	binary.copyTo(work);
+	findContours(work, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
+	for (size_t i = 0; i < contours.size(); i++) {
+		Rect r = boundingRect(contours[i]);
+		if (MAX(r.width, r.height) < minSide)
+			continue;
+		double a = contourArea(contours[i]);
+		if (a < minArea || a > maxArea)
+			continue;
+		candidates->push_back(Rect(r.x * scale, r.y * scale, r.width * scale, r.height * scale));
+	}
+}
+
+}
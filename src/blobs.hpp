@@ -0,0 +1,46 @@
+#ifndef BLOBS_HPP_
+#define BLOBS_HPP_
+
+
+#include "opencv2/core/core.hpp"
+using namespace cv;
+
+namespace track {
+
+/*
+ * Finds the bright blobs of a frame that could be robot markers, as a cheap
+ * prefilter for the circle search. The frame is reduced to 1/scale, turned
+ * greyscale and thresholded, and the outlines of its connected blobs are
+ * traced. Blobs too small to be even a robot cut off by the image edge, or
+ * too large to be a few touching robots, are dropped.
+ */
+class BlobFinder {
+public:
+	BlobFinder();
+
+	/*
+	 * Sets the reduction, the grey level of the markers (0 picks one per
+	 * frame with Otsu's method), the least part of a minRadius circle a blob
+	 * must cover and how many maxRadius circles it may cover at most.
+	 */
+	void configure(int scale, double threshold, double minFill, double maxRobots, int minRadius,
+	               int maxRadius);
+
+	/*
+	 * Returns the bounding boxes of the candidate blobs of a color image in
+	 * image coordinates.
+	 */
+	void find(const Mat &img, vector<Rect> *candidates);
+
+private:
+	int scale;
+	double threshold;
+	double minArea, maxArea;  // in reduced pixels
+	double minSide;
+
+	Mat small, gray, binary, work;
+	vector<vector<Point> > contours;
+};
+
+}
+#endif /* BLOBS_HPP_ */
@@ -1,6 +1,19 @@
 #include "opencv2/core/core.hpp"
+#include "opencv2/calib3d/calib3d.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include <fcntl.h>
+#include <limits>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "calib.hpp"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace calib {
 
 Mat loadCalib(string filename) {
@@ -18,4 +31,336 @@ void toWorld(Mat calib, float pixelX, float pixelY, float *worldX, float *worldY
 	*worldY = u.at<double>(1)/u.at<double>(2);
 }
 
+bool findCorners(const Mat &img, Size dim, vector<Point2f> *corners) {
+	Mat gray;
+	cvtColor(img, gray, CV_BGR2GRAY);
+	bool found = findChessboardCorners(gray, dim, *corners,
+			CALIB_CB_ADAPTIVE_THRESH
+			//+ CALIB_CB_NORMALIZE_IMAGE
+					+ CV_CALIB_CB_FILTER_QUADS
+			//+ CALIB_CB_FAST_CHECK
+			);
+	if (!found)
+		return false;
+
+	cornerSubPix(gray, *corners, Size(30, 30), Size(-1, -1),
+			TermCriteria(CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, 30, 0.1));
+	return true;
+}
+
+vector<Point3f> boardCorners(Size dim, Point zero, Point last) {
+	int xstep = (last.x - zero.x)/(dim.width-1);
+	int ystep = (last.y - zero.y)/(dim.height-1);
+	vector<Point3f> world;
+	for (int i = 0; i < dim.height; i++) {
+		for (int j = 0; j < dim.width; j++) {
+			world.push_back(Point3i(zero.x + (j * xstep), zero.y + (i * ystep), 0));
+		}
+	}
+	return world;
+}
+
+bool hasBoard(const Mat &img, Size dim, int maxWidth) {
+	Mat small, gray;
+	if (img.cols > maxWidth) {
+		double f = maxWidth / (double)img.cols;
+		resize(img, small, Size(), f, f, INTER_AREA);
+	} else {
+		small = img;
+	}
+	cvtColor(small, gray, CV_BGR2GRAY);
+	vector<Point2f> corners;
+	return findChessboardCorners(gray, dim, corners,
+			CALIB_CB_ADAPTIVE_THRESH + CALIB_CB_NORMALIZE_IMAGE + CALIB_CB_FAST_CHECK);
+}
+
+double calibrate(const vector<Point2f> &corners, const vector<Point3f> &world, Size imageSize,
+                 string outfile) {
+	return calibrate(vector<vector<Point2f> >(1, corners), world, imageSize, outfile);
+}
+
+double calibrate(const vector<vector<Point2f> > &views, const vector<Point3f> &world, Size imageSize,
+                 string outfile) {
+	vector<vector<Point3f> > objectPoints(views.size(), world);
+	Mat cameraMatrix;
+	Mat distCoeffs;
+	vector<Mat> rvecs;
+	vector<Mat> tvecs;
+	double error = calibrateCamera(objectPoints, views,
+			imageSize, cameraMatrix, distCoeffs, rvecs, tvecs);
+
+	Mat rvec = rvecs[0];
+	Mat tvec = tvecs[0];
+	if (views.size() > 1) {
+		// neither camera nor board moved, so the views only differ by noise
+		vector<Point2f> mean(world.size(), Point2f(0, 0));
+		for (size_t v = 0; v < views.size(); v++) {
+			for (size_t i = 0; i < mean.size(); i++) {
+				mean[i].x += views[v][i].x / views.size();
+				mean[i].y += views[v][i].y / views.size();
+			}
+		}
+		solvePnP(world, mean, cameraMatrix, distCoeffs, rvec, tvec);
+	}
+
+	FileStorage fs(outfile, FileStorage::WRITE);
+	fs << "ReprojectionError" << error;
+	fs << "Views" << (int)views.size();
+	Mat rr;
+	Rodrigues(rvec, rr);
+
+	fs << "A" << cameraMatrix << "K" << distCoeffs
+			<< "R" << rr << "T" << tvec;
+
+	Mat rt(rr);
+	Mat c = rt.col(2);
+	tvec.copyTo(c);
+
+	fs << "RT" << rt;
+
+	Mat h = cameraMatrix * rt;
+	h = h.inv();
+
+	fs << "H" << h;
+
+	fs.release();
+	return error;
+}
+
+Calibration::Calibration()
+	: loaded(false), front(1), hasLens(false), fx(1), fy(1), cx(0), cy(0),
+	  k1(0), k2(0), p1(0), p2(0), k3(0) {
+	for (int i = 0; i < 9; i++)
+		h[i] = 0;
+}
+
+bool Calibration::load(string filename) {
+	FileStorage fs(filename, FileStorage::READ);
+	Mat H, A, K;
+	fs["H"] >> H;
+	fs["A"] >> A;
+	fs["K"] >> K;
+
+	loaded = H.rows == 3 && H.cols == 3;
+	if (!loaded)
+		return false;
+	H.convertTo(H, CV_64F);
+	double scale = H.at<double>(2, 2) != 0 ? 1.0 / H.at<double>(2, 2) : 1.0;
+	// H inverts A * RT, so pixels in front of the camera had a positive w
+	front = scale < 0 ? -1 : 1;
+	for (int i = 0; i < 9; i++)
+		h[i] = (float)(H.at<double>(i / 3, i % 3) * scale);
+
+	hasLens = A.rows == 3 && A.cols == 3;
+	if (hasLens) {
+		A.convertTo(A, CV_64F);
+		fx = A.at<double>(0, 0);
+		fy = A.at<double>(1, 1);
+		cx = A.at<double>(0, 2);
+		cy = A.at<double>(1, 2);
+	}
+	k1 = k2 = p1 = p2 = k3 = 0;
+	if (hasLens && !K.empty()) {
+		K.convertTo(K, CV_64F);
+		const double *k = K.ptr<double>();
+		int n = K.total();
+		k1 = n > 0 ? k[0] : 0;
+		k2 = n > 1 ? k[1] : 0;
+		p1 = n > 2 ? k[2] : 0;
+		p2 = n > 3 ? k[3] : 0;
+		k3 = n > 4 ? k[4] : 0;
+	}
+	return true;
+}
+
+bool Calibration::empty() const {
+	return !loaded;
+}
+
+/*
+ * Inverts the lens distortion by fixed point iteration, as cvUndistortPoints
+ * does, but without building any matrices.
+ */
+void Calibration::undistortPoints(const Point2f *pixels, Point2f *out, size_t n) const {
+	for (size_t i = 0; i < n; i++) {
+		double x0 = (pixels[i].x - cx) / fx;
+		double y0 = (pixels[i].y - cy) / fy;
+		double x = x0, y = y0;
+		for (int j = 0; j < 5; j++) {
+			double r2 = x*x + y*y;
+			double icdist = 1.0 / (1 + ((k3*r2 + k2)*r2 + k1)*r2);
+			double deltaX = 2*p1*x*y + p2*(r2 + 2*x*x);
+			double deltaY = p1*(r2 + 2*y*y) + 2*p2*x*y;
+			x = (x0 - deltaX)*icdist;
+			y = (y0 - deltaY)*icdist;
+		}
+		out[i].x = (float)(x*fx + cx);
+		out[i].y = (float)(y*fy + cy);
+	}
+}
+
+void Calibration::toWorld(const Point2f *pixels, Point2f *world, size_t n, bool undistort) const {
+	if (undistort && hasLens) {
+		undistortPoints(pixels, world, n);
+		pixels = world;
+	}
+
+	const float *src = (const float *)pixels;
+	float *dst = (float *)world;
+	size_t i = 0;
+
+#ifdef __SSE2__
+	// four points per iteration, de-interleaved into x and y lanes
+	const __m128 h0 = _mm_set1_ps(h[0]), h1 = _mm_set1_ps(h[1]), h2 = _mm_set1_ps(h[2]);
+	const __m128 h3 = _mm_set1_ps(h[3]), h4 = _mm_set1_ps(h[4]), h5 = _mm_set1_ps(h[5]);
+	const __m128 h6 = _mm_set1_ps(h[6]), h7 = _mm_set1_ps(h[7]), h8 = _mm_set1_ps(h[8]);
+	for (; i + 4 <= n; i += 4) {
+		__m128 a = _mm_loadu_ps(src + 2*i);
+		__m128 b = _mm_loadu_ps(src + 2*i + 4);
+		__m128 x = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 y = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+		__m128 u = _mm_add_ps(_mm_add_ps(_mm_mul_ps(h0, x), _mm_mul_ps(h1, y)), h2);
+		__m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(h3, x), _mm_mul_ps(h4, y)), h5);
+		__m128 w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(h6, x), _mm_mul_ps(h7, y)), h8);
+		u = _mm_div_ps(u, w);
+		v = _mm_div_ps(v, w);
+		_mm_storeu_ps(dst + 2*i, _mm_unpacklo_ps(u, v));
+		_mm_storeu_ps(dst + 2*i + 4, _mm_unpackhi_ps(u, v));
+	}
+#endif
+
+	for (; i < n; i++) {
+		float x = src[2*i];
+		float y = src[2*i + 1];
+		float w = h[6]*x + h[7]*y + h[8];
+		dst[2*i] = (h[0]*x + h[1]*y + h[2]) / w;
+		dst[2*i + 1] = (h[3]*x + h[4]*y + h[5]) / w;
+	}
+}
+
+void Calibration::toWorld(const vector<Vec3f> &circles, vector<Point2f> *world, bool undistort) const {
+	world->resize(circles.size());
+	for (size_t i = 0; i < circles.size(); i++)
+		(*world)[i] = Point2f(circles[i][0], circles[i][1]);
+	if (!world->empty())
+		toWorld(&(*world)[0], &(*world)[0], world->size(), undistort);
+}
+
+bool Calibration::writeRemap(Size imageSize, string filename, bool undistort) const {
+	FILE *out = fopen(filename.c_str(), "wb");
+	if (out == NULL)
+		return false;
+
+	RemapHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "CALREMAP", sizeof(header.magic));
+	header.version = 1;
+	header.width = imageSize.width;
+	header.height = imageSize.height;
+	header.minX = header.minY = std::numeric_limits<float>::max();
+	header.maxX = header.maxY = -std::numeric_limits<float>::max();
+	// the bounds are only known once every row is written
+	bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+	vector<Point2f> pixels(imageSize.width);
+	vector<Point2f> world(imageSize.width);
+	for (int y = 0; y < imageSize.height && ok; y++) {
+		for (int x = 0; x < imageSize.width; x++)
+			pixels[x] = Point2f(x, y);
+		if (undistort && hasLens)
+			undistortPoints(&pixels[0], &pixels[0], pixels.size());
+		toWorld(&pixels[0], &world[0], world.size());
+		for (int x = 0; x < imageSize.width; x++) {
+			float w = h[6]*pixels[x].x + h[7]*pixels[x].y + h[8];
+			if (w * front <= 0 || world[x].x != world[x].x || world[x].y != world[x].y) {
+				world[x] = Point2f(nan, nan);
+				continue;
+			}
+			header.minX = MIN(header.minX, world[x].x);
+			header.minY = MIN(header.minY, world[x].y);
+			header.maxX = MAX(header.maxX, world[x].x);
+			header.maxY = MAX(header.maxY, world[x].y);
+		}
+		ok = fwrite(&world[0], sizeof(Point2f), world.size(), out) == world.size();
+	}
+
+	if (ok) {
+		rewind(out);
+		ok = fwrite(&header, sizeof(header), 1, out) == 1;
+	}
+	return fclose(out) == 0 && ok;
+}
+
+string remapFile(string calibfile) {
+	const string yaml = ".yaml";
+	if (calibfile.length() >= yaml.length()
+	    && calibfile.compare(calibfile.length() - yaml.length(), yaml.length(), yaml) == 0)
+		calibfile = calibfile.substr(0, calibfile.length() - yaml.length());
+	return calibfile + ".remap";
+}
+
+RemapTable::RemapTable() : map(NULL), length(0), header(NULL), world(NULL) {
+}
+
+RemapTable::~RemapTable() {
+	close();
+}
+
+bool RemapTable::open(string filename) {
+	close();
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(RemapHeader)) {
+		::close(fd);
+		return false;
+	}
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED)
+		return false;
+
+	const RemapHeader *h = (const RemapHeader *)data;
+	size_t needed = sizeof(RemapHeader) + (size_t)h->width * h->height * sizeof(Point2f);
+	if (memcmp(h->magic, "CALREMAP", sizeof(h->magic)) != 0 || h->version != 1
+	    || h->width <= 0 || h->height <= 0 || (size_t)st.st_size < needed) {
+		munmap(data, st.st_size);
+		return false;
+	}
+	map = data;
+	length = st.st_size;
+	header = h;
+	world = (const Point2f *)(h + 1);
+	return true;
+}
+
+void RemapTable::close() {
+	if (map != NULL)
+		munmap(map, length);
+	map = NULL;
+	length = 0;
+	header = NULL;
+	world = NULL;
+}
+
+bool RemapTable::empty() const {
+	return header == NULL;
+}
+
+Size RemapTable::size() const {
+	return header != NULL ? Size(header->width, header->height) : Size();
+}
+
+Rect_<float> RemapTable::bounds() const {
+	if (header == NULL || header->maxX < header->minX)
+		return Rect_<float>();
+	return Rect_<float>(header->minX, header->minY, header->maxX - header->minX, header->maxY - header->minY);
+}
+
+const Point2f *RemapTable::row(int y) const {
+	return world + (size_t)y * header->width;
+}
+
 }
@@ -17,5 +17,151 @@ Mat loadCalib(string filename);
  */
 void toWorld(Mat calib, float pixelX, float pixelY, float *worldX, float *worldY);
 
+
+/*
+ * Finds the inner corners of a checkerboard in a color image and refines them
+ * to sub-pixel accuracy. dim is the number of inner corners per row and
+ * column. Returns false if the board was not found.
+ */
+bool findCorners(const Mat &img, Size dim, vector<Point2f> *corners);
+
+
+/*
+ * Cheaply tests whether an image shows the whole checkerboard, by running
+ * the fast check of findChessboardCorners on a copy downscaled to at most
+ * maxWidth pixels wide. Used to reject frames before findCorners.
+ */
+bool hasBoard(const Mat &img, Size dim, int maxWidth = 640);
+
+
+/*
+ * The world coordinates of the inner corners of a checkerboard, spaced
+ * evenly from the zeroth corner to the last one.
+ */
+vector<Point3f> boardCorners(Size dim, Point zero, Point last);
+
+
+/*
+ * Calibrates a camera from the corners found in one image of size imageSize
+ * and their world coordinates, and writes the calibration file read by
+ * loadCalib and Calibration. Returns the reprojection error.
+ */
+double calibrate(const vector<Point2f> &corners, const vector<Point3f> &world, Size imageSize,
+                 string outfile);
+
+/*
+ * Calibrates a fixed camera from the corners found in several images of the
+ * same fixed board. The lens model is fitted to all views and the pose to
+ * their averaged corners, which steadies H against per-frame noise.
+ */
+double calibrate(const vector<vector<Point2f> > &views, const vector<Point3f> &world, Size imageSize,
+                 string outfile);
+
+
+/*
+ * A calibration file created by gencalib, preloaded so that whole frames of
+ * pixel coordinates can be converted into world coordinates without
+ * allocating.
+ */
+class Calibration {
+public:
+	Calibration();
+
+	/*
+	 * Loads the homography (H) and lens model (A, K) from a calibration file.
+	 * Returns false if the file has no homography.
+	 */
+	bool load(string filename);
+
+	bool empty() const;
+
+	/*
+	 * Converts n pixel coordinates into world coordinates. The pixels are
+	 * undistorted first when undistort is set. pixels and world may alias.
+	 */
+	void toWorld(const Point2f *pixels, Point2f *world, size_t n, bool undistort = false) const;
+
+	/*
+	 * Converts the centers of the circles into world coordinates.
+	 */
+	void toWorld(const vector<Vec3f> &circles, vector<Point2f> *world, bool undistort = false) const;
+
+	/*
+	 * Writes the world coordinates of every pixel of the camera's images
+	 * to a remap table file read by RemapTable. Returns false if the file
+	 * could not be written.
+	 */
+	bool writeRemap(Size imageSize, string filename, bool undistort = true) const;
+
+private:
+	void undistortPoints(const Point2f *pixels, Point2f *out, size_t n) const;
+
+	bool loaded;
+	float h[9];  // H normalised so that h[8] == 1
+	float front; // the sign of the pixels' w in front of the camera
+	bool hasLens;
+	double fx, fy, cx, cy;
+	double k1, k2, p1, p2, k3;
+};
+
+
+/*
+ * The header of a remap table file. It is followed by width * height world
+ * coordinates (two floats each), one per pixel in row-major order, which
+ * are NaN for pixels that do not see the ground plane.
+ */
+struct RemapHeader {
+	char magic[8];  // "CALREMAP"
+	int version;
+	int width;
+	int height;
+	float minX, minY, maxX, maxY;  // world bounds of the valid pixels
+};
+
+/*
+ * The remap table file that belongs to a calibration file: its name with
+ * ".yaml" replaced by ".remap".
+ */
+string remapFile(string calibfile);
+
+
+/*
+ * A remap table written by Calibration::writeRemap, mapped read-only into
+ * memory so that opening it costs no parsing or copying.
+ */
+class RemapTable {
+public:
+	RemapTable();
+	~RemapTable();
+
+	/*
+	 * Maps a remap table file. Returns false if it is missing or invalid.
+	 */
+	bool open(string filename);
+	void close();
+
+	bool empty() const;
+	Size size() const;
+
+	/*
+	 * The world bounds of the pixels that see the ground plane.
+	 */
+	Rect_<float> bounds() const;
+
+	/*
+	 * The world coordinates of the pixels of row y.
+	 */
+	const Point2f *row(int y) const;
+
+private:
+	RemapTable(const RemapTable &);
+	RemapTable &operator=(const RemapTable &);
+
+	void *map;
+	size_t length;
+	const RemapHeader *header;
+	const Point2f *world;
+};
+
 }
 #endif /* CALIB_H_ */
@@ -0,0 +1,122 @@
+#include <math.h>
+#include "fusion.hpp"
+
+namespace fusion {
+
+static float distance2(Point2f a, Point2f b) {
+	return (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y);
+}
+
+SpatialHash::SpatialHash(float cellSize) : cellSize(cellSize), points(NULL) {
+}
+
+size_t SpatialHash::bucketOf(int cx, int cy) const {
+	// the usual large primes of spatial hashing; heads has power-of-two size
+	unsigned h = ((unsigned)cx * 73856093u) ^ ((unsigned)cy * 19349663u);
+	return h & (heads.size() - 1);
+}
+
+void SpatialHash::build(const vector<Point2f> &points) {
+	this->points = &points;
+	size_t n = 16;
+	while (n < 2 * points.size())
+		n <<= 1;
+	heads.assign(n, -1);
+	next.resize(points.size());
+	for (size_t i = 0; i < points.size(); i++) {
+		size_t b = bucketOf(cvFloor(points[i].x / cellSize), cvFloor(points[i].y / cellSize));
+		next[i] = heads[b];
+		heads[b] = i;
+	}
+}
+
+void SpatialHash::query(Point2f pos, float radius, vector<int> *found) const {
+	const float r2 = radius * radius;
+	const int cx = cvFloor(pos.x / cellSize);
+	const int cy = cvFloor(pos.y / cellSize);
+	for (int y = cy - 1; y <= cy + 1; y++) {
+		for (int x = cx - 1; x <= cx + 1; x++) {
+			for (int i = heads[bucketOf(x, y)]; i >= 0; i = next[i]) {
+				const Point2f &p = (*points)[i];
+				// a bucket shared by several cells is reached more than once
+				if (cvFloor(p.x / cellSize) != x || cvFloor(p.y / cellSize) != y)
+					continue;
+				float dx = p.x - pos.x;
+				float dy = p.y - pos.y;
+				if (dx*dx + dy*dy <= r2)
+					found->push_back(i);
+			}
+		}
+	}
+}
+
+Fuser::Fuser(int cameras, float radius, long long maxAge)
+	: radius(radius), maxAge(maxAge), latest(cameras), stamps(cameras, 0), hash(radius) {
+	pthread_mutex_init(&lock, NULL);
+}
+
+Fuser::~Fuser() {
+	pthread_mutex_destroy(&lock);
+}
+
+void Fuser::update(int camera, const vector<Point2f> &points, long long stamp) {
+	pthread_mutex_lock(&lock);
+	latest[camera] = points;
+	stamps[camera] = stamp;
+	pthread_mutex_unlock(&lock);
+}
+
+long long Fuser::merge(long long now, vector<Point2f> *robots) {
+	robots->clear();
+	points.clear();
+	owner.clear();
+	long long oldest = 0;
+
+	pthread_mutex_lock(&lock);
+	for (size_t c = 0; c < latest.size(); c++) {
+		if (stamps[c] == 0 || now - stamps[c] > maxAge)
+			continue;
+		if (!latest[c].empty() && (oldest == 0 || stamps[c] < oldest))
+			oldest = stamps[c];
+		points.insert(points.end(), latest[c].begin(), latest[c].end());
+		owner.insert(owner.end(), latest[c].size(), (int)c);
+	}
+	pthread_mutex_unlock(&lock);
+
+	// each robot is the average of an unmerged point and the closest unmerged
+	// point of every other camera within the radius
+	hash.build(points);
+	used.assign(points.size(), false);
+	for (size_t i = 0; i < points.size(); i++) {
+		if (used[i])
+			continue;
+		used[i] = true;
+		near.clear();
+		hash.query(points[i], radius, &near);
+
+		best.assign(latest.size(), -1);
+		for (size_t k = 0; k < near.size(); k++) {
+			int j = near[k];
+			int c = owner[j];
+			if (used[j] || c == owner[i])
+				continue;
+			if (best[c] < 0 || distance2(points[i], points[j]) < distance2(points[i], points[best[c]]))
+				best[c] = j;
+		}
+
+		Point2f sum = points[i];
+		int count = 1;
+		for (size_t c = 0; c < best.size(); c++) {
+			if (best[c] < 0)
+				continue;
+			used[best[c]] = true;
+			sum.x += points[best[c]].x;
+			sum.y += points[best[c]].y;
+			count++;
+		}
+		robots->push_back(Point2f(sum.x / count, sum.y / count));
+	}
+	return oldest;
+}
+
+}
@@ -0,0 +1,83 @@
+#ifndef FUSION_HPP_
+#define FUSION_HPP_
+
+#include <pthread.h>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+using namespace cv;
+
+namespace fusion {
+
+/*
+ * A uniform grid over the world plane hashed into a fixed number of buckets,
+ * for finding the points near a position without comparing every pair.
+ * Points in different cells may share a bucket, so callers still check the
+ * distance of every candidate.
+ */
+class SpatialHash {
+public:
+	SpatialHash(float cellSize);
+
+	/*
+	 * Replaces the indexed points.
+	 */
+	void build(const vector<Point2f> &points);
+
+	/*
+	 * Appends the indices of the points within radius of pos, which must not
+	 * exceed the cell size.
+	 */
+	void query(Point2f pos, float radius, vector<int> *found) const;
+
+private:
+	size_t bucketOf(int cx, int cy) const;
+
+	float cellSize;
+	const vector<Point2f> *points;
+	vector<int> heads;  // first point of each bucket or -1
+	vector<int> next;   // next point in the same bucket or -1
+};
+
+/*
+ * Merges the world positions reported by overlapping cameras into one
+ * robot list. Every camera's newest detections are kept with the capture
+ * time of their frame; detections within the merge radius of each other
+ * are averaged into one robot and cameras whose newest frame is older than
+ * maxAge are left out.
+ */
+class Fuser {
+public:
+	Fuser(int cameras, float radius, long long maxAge);
+	~Fuser();
+
+	/*
+	 * Replaces the detections of a camera. Safe to call from any thread.
+	 */
+	void update(int camera, const vector<Point2f> &points, long long stamp);
+
+	/*
+	 * Merges the current detections as of now. Returns the capture time of
+	 * the oldest frame that contributed, or 0 if none did.
+	 */
+	long long merge(long long now, vector<Point2f> *robots);
+
+private:
+	float radius;
+	long long maxAge;
+
+	pthread_mutex_t lock;  // guards latest and stamps
+	vector<vector<Point2f> > latest;
+	vector<long long> stamps;
+
+	// merge buffers, reused between calls
+	vector<Point2f> points;
+	vector<int> owner;  // the camera of each point
+	vector<bool> used;
+	vector<int> near;
+	vector<int> best;   // the closest point of each camera to merge
+	SpatialHash hash;
+};
+
+}
+#endif /* FUSION_HPP_ */
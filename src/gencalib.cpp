@@ -1,25 +1,40 @@
 #include "opencv2/calib3d/calib3d.hpp"
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
+#include <fstream>
 #include <iostream>
 #include <stdio.h>
+#include <time.h>
 #include <unistd.h>
 #include "calib.hpp"
+#include "pipeline.hpp"
+#include "source.hpp"
 using namespace cv;
 using namespace std;
 
 void help() {
-	cout << "Usage: gencalib [-dh] -i <image> <rows> <cols>" << endl
-	     << "       gencalib [-dh] -i <image> -o <calib> <rows> <cols> <zero-x> <zero-y> <last-x> <last-y>" << endl
+	cout << "Usage: gencalib [-dh] -i <image>|-v <input> <rows> <cols>" << endl
+	     << "       gencalib [-dh] -i <image>|-v <input> [-n <frames>] -o <calib> <rows> <cols> <zero-x> <zero-y> <last-x> <last-y>" << endl
+	     << "       gencalib [-dh] -b <manifest> <rows> <cols>" << endl
 	     << "Description:" << endl
 	     << "  Generates a camera calibration file used to convert pixel coordinates into" << endl
-	     << "  world coordinates. There are two modes of operation as shown above. The first" << endl
+	     << "  world coordinates. There are three modes of operation as shown above. The first" << endl
 	     << "  simply detects internal corners and displays the indices. The second generates" << endl
 	     << "  a calibration file using the world coordinates of the zeroth and last corners." << endl
+	     << "  The third calibrates every camera of a manifest in parallel without a display," << endl
+	     << "  writing <image name>-calib.yaml next to each image and a table of the" << endl
+	     << "  reprojection errors. Every calibration file <name>.yaml comes with a remap" << endl
+	     << "  table <name>.remap holding the world coordinates of every pixel, which the" << endl
+	     << "  mosaic viewer maps into memory." << endl
 	     << "Params:" << endl
-	     << "  -d:     Debugging output"
+	     << "  -d:     Debugging output" << endl
 	     << "  image:  the calibration input image" << endl
+	     << "  input:  video input device number or recording to grab a frame from" << endl
+	     << "  frames: grab a burst of this many frames from the input and calibrate from every" << endl
+	     << "          frame that shows the board (default 1)" << endl
 	     << "  calib:  the calibration output file (must end in \".yaml\")" << endl
+	     << "  manifest: one \"<image>: <zero-x>,<zero-y> <last-x>,<last-y>\" line per camera" << endl
+	     << "          (see conf/calib.txt); images are relative to the manifest" << endl
 	     << "  rows:   the number of rows in the checkerboard" << endl
 	     << "  cols:   the number of columns in the checkerboard" << endl
 	     << "  zero-x: the world x-coordinate for the zeroth point" << endl
@@ -38,6 +53,157 @@ bool hasEnding (string const &fullString, string const &ending)
     }
 }
 
+/*
+ * Writes the remap table of a calibration file next to it.
+ */
+bool writeRemap(string calibfile, Size imageSize) {
+	calib::Calibration calibration;
+	return calibration.load(calibfile)
+	       && calibration.writeRemap(imageSize, calib::remapFile(calibfile));
+}
+
+/*
+ * One camera of a batch run and its outcome.
+ */
+struct Job {
+	string name;
+	string image;
+	string outfile;
+	Point zero, last;
+
+	bool found;
+	bool remapped;
+	size_t corners;
+	double error;
+	long ms;
+};
+
+/*
+ * The work shared by the threads of a batch run.
+ */
+struct Batch {
+	vector<Job> jobs;
+	Size dim;
+};
+
+bool readManifest(string filename, vector<Job> *jobs) {
+	ifstream in(filename.c_str());
+	if (!in.is_open())
+		return false;
+
+	string dir;
+	size_t slash = filename.rfind('/');
+	if (slash != string::npos)
+		dir = filename.substr(0, slash + 1);
+
+	string line;
+	while (getline(in, line)) {
+		char image[256];
+		Job job;
+		if (sscanf(line.c_str(), " %255[^:]: %d,%d %d,%d", image, &job.zero.x, &job.zero.y,
+		           &job.last.x, &job.last.y) != 5)
+			continue;
+		job.image = dir + image;
+		job.name = string(image);
+		size_t dot = job.name.rfind('.');
+		if (dot != string::npos)
+			job.name = job.name.substr(0, dot);
+		job.outfile = dir + job.name + "-calib.yaml";
+		job.found = false;
+		job.remapped = false;
+		job.corners = 0;
+		job.error = 0;
+		job.ms = 0;
+		jobs->push_back(job);
+	}
+	return true;
+}
+
+void calibrateJob(int i, void *arg) {
+	Batch *batch = (Batch *)arg;
+	Job &job = batch->jobs[i];
+	timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	Mat src = imread(job.image, 1);
+	vector<Point2f> corners;
+	if (!src.empty() && calib::findCorners(src, batch->dim, &corners)) {
+		job.found = true;
+		job.corners = corners.size();
+		job.error = calib::calibrate(corners, calib::boardCorners(batch->dim, job.zero, job.last),
+				src.size(), job.outfile);
+		job.remapped = writeRemap(job.outfile, src.size());
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	job.ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+}
+
+/*
+ * Calibrates every camera of a manifest, one thread per core.
+ */
+int batchCalibrate(string manifest, Size dim) {
+	Batch batch;
+	batch.dim = dim;
+	if (!readManifest(manifest, &batch.jobs)) {
+		cout << "Cannot read manifest: " << manifest << endl;
+		return 1;
+	}
+	if (batch.jobs.empty()) {
+		cout << "No cameras in manifest: " << manifest << endl;
+		return 1;
+	}
+
+	pipeline::parallelFor(batch.jobs.size(), calibrateJob, &batch);
+
+	int failed = 0;
+	printf("%-12s %8s %12s %8s  %s\n", "camera", "corners", "reproj err", "ms", "calibration");
+	for (size_t i = 0; i < batch.jobs.size(); i++) {
+		const Job &job = batch.jobs[i];
+		if (job.found) {
+			printf("%-12s %8lu %12.4f %8ld  %s%s\n", job.name.c_str(), (unsigned long)job.corners,
+			       job.error, job.ms, job.outfile.c_str(), job.remapped ? "" : " (no remap table)");
+			if (!job.remapped)
+				failed++;
+		} else {
+			string reason = "corners not found in " + job.image;
+			printf("%-12s %8s %12s %8ld  %s\n", job.name.c_str(), "-", "-", job.ms, reason.c_str());
+			failed++;
+		}
+	}
+	return failed > 0 ? 1 : 0;
+}
+
+/*
+ * The frames of a burst and the corners found in each.
+ */
+struct Burst {
+	vector<Mat> frames;
+	Size dim;
+	vector<vector<Point2f> > corners;
+	vector<char> found;
+};
+
+void findBoard(int i, void *arg) {
+	Burst *burst = (Burst *)arg;
+	burst->found[i] = calib::findCorners(burst->frames[i], burst->dim, &burst->corners[i]);
+}
+
+/*
+ * Finds the board in every frame of a burst. Frames failing the cheap check
+ * are dropped before the full corner search, which runs in parallel.
+ */
+void findBoards(Burst *burst) {
+	size_t kept = 0;
+	for (size_t i = 0; i < burst->frames.size(); i++)
+		if (calib::hasBoard(burst->frames[i], burst->dim))
+			burst->frames[kept++] = burst->frames[i];
+	burst->frames.resize(kept);
+
+	burst->corners.assign(kept, vector<Point2f>());
+	burst->found.assign(kept, 0);
+	pipeline::parallelFor(kept, findBoard, burst);
+}
 
 int main(int argc, char** argv) {
 
@@ -45,11 +211,14 @@ int main(int argc, char** argv) {
 	bool iopt = false;
 	string infile;
 	bool vopt = false;
-	int cam = 0;
+	string input;
 	bool calib = false;
 	string outfile;
+	bool bopt = false;
+	string manifest;
+	int burst = 1;
 	int c;
-	while ((c = getopt(argc, argv, "hdi:v:o:")) != -1) {
+	while ((c = getopt(argc, argv, "hdi:v:o:b:n:")) != -1) {
 		switch (c){
 		case 'd':
 			debug = true;
@@ -60,7 +229,14 @@ int main(int argc, char** argv) {
 			break;
 		case 'v':
 			vopt = true;
-			cam = atoi(optarg);
+			input = string(optarg);
+			break;
+		case 'n':
+			burst = atoi(optarg);
+			break;
+		case 'b':
+			bopt = true;
+			manifest = string(optarg);
 			break;
 		case 'o':
 			calib = true;
@@ -82,7 +258,13 @@ int main(int argc, char** argv) {
 	}
 
 	int rem = argc - optind;
-	if (!(iopt ^ vopt) || (calib && rem != 6) || (!calib && rem != 2)) {
+	if (bopt && (iopt || vopt || calib || rem != 2)) {
+		cout << "Invalid arguments." << endl << endl;
+		help();
+		return 1;
+	}
+	if (!bopt && (!(iopt ^ vopt) || (calib && rem != 6) || (!calib && rem != 2) || burst < 1
+	              || (iopt && burst > 1))) {
 		cout << "Invalid arguments." << endl << endl;
 		help();
 		return 1;
@@ -101,48 +283,57 @@ int main(int argc, char** argv) {
 	int icols = cols - 1;
 	Size dim(icols, irows);
 
-	Mat src;
+	if (bopt)
+		return batchCalibrate(manifest, dim);
+
+	Burst frames;
+	frames.dim = dim;
 	if (iopt) {
-		src = imread(infile, 1);
+		frames.frames.push_back(imread(infile, 1));
 		cout << "Detecting corners of " << rows << "x" << cols << " board in "
 				<< infile << "..." << endl;
 
 	} else {
-	    VideoCapture cap(cam);
-	    if (!cap.isOpened()) // check if we succeeded
+	    source::FrameSource *cap = source::openSource(input, source::Options());
+	    if (cap == NULL) // check if we succeeded
 	    {
 	        cout << "Cannot initialize video capturing" << endl << endl;
 	        return -1;
 	    }
-	    cap.set(CV_CAP_PROP_FRAME_WIDTH, 1600);
-	    cap.set(CV_CAP_PROP_FRAME_HEIGHT, 1200);
-	    cout << "Capture from camera" << endl;
+	    cout << "Capture from " << input << endl;
 		Mat live;
-	    cap.read(live);
-	    src = live.clone();
-	    cap.release();
-		cout << "Detecting corners of " << rows << "x" << cols << " board in video"
-				<< cam << "..." << endl;
+		for (int i = 0; i < burst && cap->read(live); i++)
+			frames.frames.push_back(live.clone());
+	    delete cap;
+		cout << "Detecting corners of " << rows << "x" << cols << " board in "
+				<< frames.frames.size() << " frame(s) of " << input << "..." << endl;
 
 	}
 
-	Mat gray;
-	cvtColor(src, gray, CV_BGR2GRAY);
-	vector<Point2f> corners;
-	bool found = findChessboardCorners(gray, dim, corners,
-			CALIB_CB_ADAPTIVE_THRESH
-			//+ CALIB_CB_NORMALIZE_IMAGE
-					+ CV_CALIB_CB_FILTER_QUADS
-			//+ CALIB_CB_FAST_CHECK
-			);
-
-	if (found) {
-		for (int i = 0; i < corners.size(); i++) {
-			circle(src, corners[i], 3, Scalar(0, 0, 255), -1, 8, 0);
+	vector<vector<Point2f> > views;
+	Mat src;
+	if (frames.frames.size() == 1) {
+		views.resize(1);
+		src = frames.frames[0];
+		if (!calib::findCorners(src, dim, &views[0]))
+			views.clear();
+	} else {
+		size_t grabbed = frames.frames.size();
+		findBoards(&frames);
+		for (size_t i = 0; i < frames.frames.size(); i++) {
+			if (!frames.found[i])
+				continue;
+			if (views.empty())
+				src = frames.frames[i];
+			views.push_back(frames.corners[i]);
 		}
+		cout << "Board found in " << views.size() << " of " << grabbed << " frames ("
+				<< frames.frames.size() << " passed the fast check)" << endl;
+	}
+	bool found = !views.empty();
 
-		cornerSubPix(gray, corners, Size(30, 30), Size(-1, -1),
-				TermCriteria(CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, 30, 0.1));
+	if (found) {
+		const vector<Point2f> &corners = views[0];
 		for (int i = 0; i < corners.size(); i++) {
 			circle(src, corners[i], 3, Scalar(0, 255, 0), -1, 8, 0);
 			char ss[4];
@@ -158,51 +349,18 @@ int main(int argc, char** argv) {
 			int ay = atoi(argv[optind++]);
 			int bx = atoi(argv[optind++]);
 			int by = atoi(argv[optind++]);
-			int xstep = (bx - ax)/(icols-1);
-			int ystep = (by - ay)/(irows-1);
 			if (debug) {
-				cout << "xstep: " << xstep << endl;
-				cout << "ystep: " << ystep << endl;
-			}
-			vector<Point3f> world;
-			for (int i = 0; i < irows; i++) {
-				for (int j = 0; j < icols; j++) {
-					world.push_back(Point3i(ax + (j * xstep), ay + (i * ystep), 0));
-				}
+				cout << "xstep: " << (bx - ax)/(icols-1) << endl;
+				cout << "ystep: " << (by - ay)/(irows-1) << endl;
 			}
-
-			vector<vector<Point3f> > objectPoints;
-			objectPoints.push_back(world);
-			vector<vector<Point2f> > imagePoints;
-			imagePoints.push_back(corners);
-			Mat cameraMatrix;
-			Mat distCoeffs;
-			vector<Mat> rvecs;
-			vector<Mat> tvecs;
-			double error = calibrateCamera(objectPoints, imagePoints,
-					src.size(), cameraMatrix, distCoeffs, rvecs, tvecs);
+			vector<Point3f> world = calib::boardCorners(dim, Point(ax, ay), Point(bx, by));
+			double error = calib::calibrate(views, world, src.size(), outfile);
 			cout << "Calibration reprojection error: " << error << endl;
-			FileStorage fs(outfile, FileStorage::WRITE);
-			fs << "ReprojectionError" << error;
-			Mat rr;
-			Rodrigues(rvecs[0], rr);
-
-			fs << "A" << cameraMatrix << "K" << distCoeffs
-					<< "R" << rr << "T" << tvecs[0];
-
-			Mat rt(rr);
-			Mat c = rt.col(2);
-			tvecs[0].copyTo(c);
-
-			fs << "RT" << rt;
-
-			Mat h = cameraMatrix * rt;
-			h = h.inv();
-
-			fs << "H" << h;
-
-			fs.release();
 			cout << "Created calibration file: " << outfile << endl;
+			if (writeRemap(outfile, src.size()))
+				cout << "Created remap table: " << calib::remapFile(outfile) << endl;
+			else
+				cout << "Cannot write remap table: " << calib::remapFile(outfile) << endl;
 
 			if (debug) {
 				cout << "Reprojection of points:" << endl;
@@ -0,0 +1,154 @@
+#include <fstream>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include "synth.hpp"
+
+using namespace std;
+using namespace cv;
+
+void help() {
+	cout << "Usage: gensynth [option]* -o <dir>" << endl
+	     << "Description:" << endl
+	     << "  Renders frames of circular robots moving around an arena, with noise, blur," << endl
+	     << "  robots cut off by the image edges and changing lighting, and logs where" << endl
+	     << "  every robot was. The frames are written to <dir> as frame<N>.png, which" << endl
+	     << "  tracker and trackerconf read as a recording (-v <dir>). Two logs go with them:" << endl
+	     << "    truth.txt   \"<image> <robots> <x0> <y0> ...\" per frame, the robots whose" << endl
+	     << "                centre is within the frame, as read by trackerconf -a" << endl
+	     << "    robots.txt  \"<frame> <id> <x> <y> <radius> <visible>\" per robot and frame" << endl
+	     << "  tracker can also render the same frames itself with -v synth:<robots>,<seed>" << endl
+	     << "  (at its capture size and 20 fps), which these logs then describe." << endl
+	     << "Options:" << endl
+	     << "  -b <min>,<max> radius band of the robots in pixels (default 60,80)" << endl
+	     << "  -B <sigma>   blur (default 1.5, 0 disables)" << endl
+	     << "  -e <ext>     image format of the frames (default png)" << endl
+	     << "  -f <fps>     frame rate of the simulation (default 20)" << endl
+	     << "  -h           this help info" << endl
+	     << "  -L <amount>  relative amplitude of the lighting changes (default 0.3)" << endl
+	     << "  -n <frames>  number of frames (default 200)" << endl
+	     << "  -N <sigma>   pixel noise (default 8)" << endl
+	     << "  -o <dir>     output directory, created if missing" << endl
+	     << "  -r <robots>  number of robots (default 10)" << endl
+	     << "  -s <speed>   top robot speed in pixels per second (default 200)" << endl
+	     << "  -S <seed>    random seed (default 1)" << endl
+	     << "  -x <width>:  the pixel width of the frames (default 1600)" << endl
+	     << "  -y <height>: the pixel height of the frames (default 1200)" << endl
+;
+}
+
+int main(int argc, char** argv) {
+	synth::Options opts;
+	int frames = 200;
+	string dir;
+	string ext = "png";
+
+	int c;
+	while ((c = getopt(argc, argv, "hb:B:e:f:L:n:N:o:r:s:S:x:y:")) != -1) {
+		switch (c) {
+		case 'b':
+			if (sscanf(optarg, "%d,%d", &opts.minRadius, &opts.maxRadius) != 2) {
+				cout << "Invalid radius band: " << optarg << endl << endl;
+				help();
+				return 1;
+			}
+			break;
+		case 'B':
+			opts.blur = atof(optarg);
+			break;
+		case 'e':
+			ext = string(optarg);
+			break;
+		case 'f':
+			opts.fps = atof(optarg);
+			break;
+		case 'L':
+			opts.lighting = atof(optarg);
+			break;
+		case 'n':
+			frames = atoi(optarg);
+			break;
+		case 'N':
+			opts.noise = atof(optarg);
+			break;
+		case 'o':
+			dir = string(optarg);
+			break;
+		case 'r':
+			opts.robots = atoi(optarg);
+			break;
+		case 's':
+			opts.speed = atof(optarg);
+			break;
+		case 'S':
+			opts.seed = strtoul(optarg, NULL, 10);
+			break;
+		case 'x':
+			opts.width = atoi(optarg);
+			break;
+		case 'y':
+			opts.height = atoi(optarg);
+			break;
+		case 'h':
+			help();
+			return 0;
+		case '?':
+			cout << "Invalid arguments." << endl << endl;
+			help();
+			return 1;
+		}
+	}
+	if (dir.empty()) {
+		cout << "No output directory specified." << endl << endl;
+		help();
+		return 1;
+	}
+	if (opts.width <= 0 || opts.height <= 0 || opts.robots < 0 || frames < 1) {
+		cout << "Invalid frame size, robot or frame count." << endl;
+		return 1;
+	}
+
+	mkdir(dir.c_str(), 0755);
+	ofstream truth((dir + "/truth.txt").c_str());
+	ofstream robots((dir + "/robots.txt").c_str());
+	if (!truth.is_open() || !robots.is_open()) {
+		cout << "Cannot write to output directory: " << dir << endl;
+		return 1;
+	}
+	truth << "# <image> <robots> <x0> <y0> ... in pixels, robots ordered by ID" << endl;
+	robots << "# <frame> <id> <x> <y> <radius> <visible>" << endl;
+
+	synth::Arena arena(opts);
+	Mat frame;
+	char name[64];
+	for (int f = 0; f < frames; f++) {
+		arena.next(frame);
+		snprintf(name, sizeof(name), "frame%05d.%s", f, ext.c_str());
+		if (!imwrite(dir + "/" + name, frame)) {
+			cout << "Cannot write frame: " << dir << "/" << name << endl;
+			return 1;
+		}
+
+		const vector<synth::Robot> &bots = arena.robots();
+		int visible = 0;
+		for (size_t i = 0; i < bots.size(); i++)
+			if (arena.visible(bots[i]))
+				visible++;
+		truth << name << " " << visible;
+		for (size_t i = 0; i < bots.size(); i++) {
+			const synth::Robot &b = bots[i];
+			if (arena.visible(b))
+				truth << " " << b.pos.x << " " << b.pos.y;
+			robots << f << " " << b.id << " " << b.pos.x << " " << b.pos.y << " " << b.radius << " "
+			       << (arena.visible(b) ? 1 : 0) << endl;
+		}
+		truth << endl;
+	}
+
+	cout << "Rendered " << frames << " frames of " << opts.robots << " robots to " << dir << endl;
+	return 0;
+}
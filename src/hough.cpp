@@ -0,0 +1,350 @@
+#include <algorithm>
+#include <math.h>
+#include "opencv2/imgproc/imgproc.hpp"
+#include "hough.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace cv;
+
+namespace track {
+
+static const int SHIFT = 10;  // fixed point precision of the voting rays
+static const int ONE = 1 << SHIFT;
+
+/*
+ * Orders accumulator cells by their votes, strongest first.
+ */
+struct ByVotes {
+	const int *accum;
+	ByVotes(const int *accum) : accum(accum) {}
+	bool operator()(int a, int b) const {
+		return accum[a] > accum[b] || (accum[a] == accum[b] && a < b);
+	}
+};
+
+CircleHough::CircleHough() : bandMin(0), bandMax(0) {
+}
+
+void CircleHough::collectEdges() {
+	edgeX.clear();
+	edgeY.clear();
+	gradX.clear();
+	gradY.clear();
+	rowStart.resize(edges.rows + 1);
+	for (int y = 0; y < edges.rows; y++) {
+		rowStart[y] = edgeX.size();
+		const uchar *e = edges.ptr<uchar>(y);
+		const short *gx = dx.ptr<short>(y);
+		const short *gy = dy.ptr<short>(y);
+		for (int x = 0; x < edges.cols; x++) {
+			if (e[x] == 0)
+				continue;
+			edgeX.push_back(x);
+			edgeY.push_back(y);
+			gradX.push_back(gx[x]);
+			gradY.push_back(gy[x]);
+		}
+	}
+	rowStart[edges.rows] = edgeX.size();
+}
+
+/*
+ * Turns the edge gradients into unit vectors, four at a time.
+ */
+void CircleHough::normalizeGradients() {
+	size_t n = gradX.size();
+	size_t i = 0;
+	float *gx = n > 0 ? &gradX[0] : NULL;
+	float *gy = n > 0 ? &gradY[0] : NULL;
+
+#ifdef __SSE2__
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 three = _mm_set1_ps(3.0f);
+	const __m128 tiny = _mm_set1_ps(1e-12f);
+	for (; i + 4 <= n; i += 4) {
+		__m128 x = _mm_loadu_ps(gx + i);
+		__m128 y = _mm_loadu_ps(gy + i);
+		__m128 m = _mm_max_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), tiny);
+		__m128 r = _mm_rsqrt_ps(m);
+		// one Newton-Raphson step brings rsqrt to full float precision
+		r = _mm_mul_ps(_mm_mul_ps(half, r), _mm_sub_ps(three, _mm_mul_ps(_mm_mul_ps(m, r), r)));
+		_mm_storeu_ps(gx + i, _mm_mul_ps(x, r));
+		_mm_storeu_ps(gy + i, _mm_mul_ps(y, r));
+	}
+#endif
+
+	for (; i < n; i++) {
+		float m = sqrtf(gx[i]*gx[i] + gy[i]*gy[i]);
+		if (m < 1e-6f)
+			m = 1e-6f;
+		gx[i] /= m;
+		gy[i] /= m;
+	}
+}
+
+/*
+ * Votes along one ray of the radius band in fixed point, from the centre
+ * minRadius away to the one maxRadius away.
+ */
+static inline void voteRay(int *acc, int rows, int cols, int ex, int ey, int sx, int sy, int minRadius,
+                           int maxRadius) {
+	int x = (ex << SHIFT) + sx * minRadius + ONE/2;
+	int y = (ey << SHIFT) + sy * minRadius + ONE/2;
+	for (int r = minRadius; r <= maxRadius; r++, x += sx, y += sy) {
+		unsigned cx = (unsigned)(x >> SHIFT);
+		unsigned cy = (unsigned)(y >> SHIFT);
+		// the ray leaves the image for good once it is outside
+		if (cx >= (unsigned)cols || cy >= (unsigned)rows)
+			break;
+		acc[cy * cols + cx]++;
+	}
+}
+
+#ifdef __SSE2__
+/*
+ * Votes along the rays of four edges on one side at once. The rays step
+ * in lockstep, leaving the loop once all have left the image, and each
+ * step's cells are addressed with a single multiply-add of the packed
+ * (cy, cx) pairs, which needs both sides of the image below 2^15. Only
+ * the increments themselves are scattered one by one.
+ */
+static inline void voteRays4(int *acc, int rows, int cols, const int *ex, const int *ey, const float *gx,
+                             const float *gy, float sign, int minRadius, int maxRadius) {
+	const __m128 scale = _mm_set1_ps(sign * ONE);
+	__m128i sx = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(gx), scale));
+	__m128i sy = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(gy), scale));
+
+	// SSE2 has no 32 bit multiply, so the starting points are set up per ray
+	int step[8];
+	int start[8];
+	_mm_storeu_si128((__m128i *)step, sx);
+	_mm_storeu_si128((__m128i *)(step + 4), sy);
+	for (int k = 0; k < 4; k++) {
+		start[k] = (ex[k] << SHIFT) + step[k] * minRadius + ONE/2;
+		start[k + 4] = (ey[k] << SHIFT) + step[k + 4] * minRadius + ONE/2;
+	}
+	__m128i x = _mm_loadu_si128((const __m128i *)start);
+	__m128i y = _mm_loadu_si128((const __m128i *)(start + 4));
+
+	const __m128i none = _mm_set1_epi32(-1);
+	const __m128i colsV = _mm_set1_epi32(cols);
+	const __m128i rowsV = _mm_set1_epi32(rows);
+	const __m128i low = _mm_set1_epi32(0xffff);
+	const __m128i stride = _mm_set1_epi32((1 << 16) | cols);  // cy * cols + cx * 1
+	__m128i alive = none;
+	int cells[4];
+	for (int r = minRadius; r <= maxRadius; r++) {
+		__m128i cx = _mm_srai_epi32(x, SHIFT);
+		__m128i cy = _mm_srai_epi32(y, SHIFT);
+		__m128i inside = _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi32(cx, none), _mm_cmplt_epi32(cx, colsV)),
+		                               _mm_and_si128(_mm_cmpgt_epi32(cy, none), _mm_cmplt_epi32(cy, rowsV)));
+		alive = _mm_and_si128(alive, inside);
+		int live = _mm_movemask_ps(_mm_castsi128_ps(alive));
+		if (live == 0)
+			break;
+		__m128i packed = _mm_or_si128(_mm_slli_epi32(cx, 16), _mm_and_si128(cy, low));
+		_mm_storeu_si128((__m128i *)cells, _mm_madd_epi16(packed, stride));
+		if (live & 1)
+			acc[cells[0]]++;
+		if (live & 2)
+			acc[cells[1]]++;
+		if (live & 4)
+			acc[cells[2]]++;
+		if (live & 8)
+			acc[cells[3]]++;
+		x = _mm_add_epi32(x, sx);
+		y = _mm_add_epi32(y, sy);
+	}
+}
+#endif
+
+/*
+ * Every edge pixel votes for the centres that lie within the radius band
+ * along its gradient, on both sides of the edge.
+ */
+void CircleHough::vote(int minRadius, int maxRadius) {
+	const int rows = edges.rows;
+	const int cols = edges.cols;
+	accum.assign(rows * cols, 0);
+	int *acc = &accum[0];
+	const size_t n = edgeX.size();
+	size_t i = 0;
+
+#ifdef __SSE2__
+	if (rows < (1 << 15) && cols < (1 << 15)) {
+		for (; i + 4 <= n; i += 4) {
+			voteRays4(acc, rows, cols, &edgeX[i], &edgeY[i], &gradX[i], &gradY[i], -1, minRadius, maxRadius);
+			voteRays4(acc, rows, cols, &edgeX[i], &edgeY[i], &gradX[i], &gradY[i], 1, minRadius, maxRadius);
+		}
+	}
+#endif
+
+	for (; i < n; i++) {
+		for (int sign = -1; sign <= 1; sign += 2) {
+			int sx = cvRound(sign * gradX[i] * ONE);
+			int sy = cvRound(sign * gradY[i] * ONE);
+			voteRay(acc, rows, cols, edgeX[i], edgeY[i], sx, sy, minRadius, maxRadius);
+		}
+	}
+}
+
+/*
+ * Keeps the local maxima above the threshold, the maxCircles strongest
+ * sorted first.
+ */
+void CircleHough::findCentres(double accThresh, int maxCircles) {
+	const int rows = edges.rows;
+	const int cols = edges.cols;
+	const int *acc = &accum[0];
+
+	centres.clear();
+	for (int y = 1; y < rows - 1; y++) {
+		for (int x = 1; x < cols - 1; x++) {
+			int i = y * cols + x;
+			int v = acc[i];
+			if (v > accThresh && v > acc[i-1] && v >= acc[i+1] && v > acc[i-cols] && v >= acc[i+cols])
+				centres.push_back(i);
+		}
+	}
+
+	ByVotes byVotes(acc);
+	if (maxCircles > 0 && centres.size() > (size_t)maxCircles) {
+		nth_element(centres.begin(), centres.begin() + maxCircles, centres.end(), byVotes);
+		centres.resize(maxCircles);
+	}
+	sort(centres.begin(), centres.end(), byVotes);
+}
+
+/*
+ * Picks the radius whose ring around the centre holds the most edge pixels
+ * relative to its length, as HoughCircles does.
+ */
+bool CircleHough::estimateRadius(int cx, int cy, int minRadius, int maxRadius, double accThresh,
+                                 float *radius) {
+	const int min2 = minRadius * minRadius;
+	const int max2 = maxRadius * maxRadius;
+	hist.assign(maxRadius + 1, 0);
+
+	int y0 = max(cy - maxRadius, 0);
+	int y1 = min(cy + maxRadius, edges.rows - 1);
+	for (int y = y0; y <= y1; y++) {
+		int ddy = y - cy;
+		vector<int>::const_iterator begin = edgeX.begin() + rowStart[y];
+		vector<int>::const_iterator end = edgeX.begin() + rowStart[y + 1];
+		for (vector<int>::const_iterator it = lower_bound(begin, end, cx - maxRadius);
+		     it != end && *it <= cx + maxRadius; ++it) {
+			int ddx = *it - cx;
+			int d2 = ddx*ddx + ddy*ddy;
+			if (d2 >= min2 && d2 <= max2)
+				hist[radiusOf[d2]]++;
+		}
+	}
+
+	int best = 0;
+	int bestCount = 0;
+	for (int r = max(minRadius, 1); r <= maxRadius; r++) {
+		if (hist[r] > 0 && (best == 0 || hist[r] * best > bestCount * r)) {
+			best = r;
+			bestCount = hist[r];
+		}
+	}
+	*radius = best;
+	return best > 0 && bestCount > accThresh;
+}
+
+void CircleHough::findEdges(const Mat &gray, double cannyThresh) {
+	if (edgeBuf.rows < gray.rows || edgeBuf.cols < gray.cols) {
+		Size size(max(edgeBuf.cols, gray.cols), max(edgeBuf.rows, gray.rows));
+		edgeBuf.create(size, CV_8U);
+		dxBuf.create(size, CV_16S);
+		dyBuf.create(size, CV_16S);
+	}
+	Rect area(0, 0, gray.cols, gray.rows);
+	edges = edgeBuf(area);
+	dx = dxBuf(area);
+	dy = dyBuf(area);
+
+	Canny(gray, edges, MAX(cannyThresh/2, 1), cannyThresh, 3);
+	Sobel(gray, dx, CV_16S, 1, 0, 3);
+	Sobel(gray, dy, CV_16S, 0, 1, 3);
+
+	collectEdges();
+	normalizeGradients();
+}
+
+void CircleHough::accumulate(int minRadius, int maxRadius) {
+	bandMin = max(minRadius, 0);
+	bandMax = maxRadius > 0 ? maxRadius : max(edges.rows, edges.cols);
+	if (bandMax < bandMin || edges.rows < 3 || edges.cols < 3) {
+		accum.clear();
+		return;
+	}
+	vote(bandMin, bandMax);
+}
+
+void CircleHough::findCircles(vector<Vec3f> *circles, double minDist, double accThresh, int maxCircles,
+                              vector<int> *votes) {
+	circles->clear();
+	if (votes != NULL)
+		votes->clear();
+	if (accum.empty())
+		return;
+
+	findCentres(accThresh, maxCircles);
+
+	int max2 = bandMax * bandMax;
+	if ((int)radiusOf.size() != max2 + 1) {
+		radiusOf.resize(max2 + 1);
+		for (int d2 = 0; d2 <= max2; d2++)
+			radiusOf[d2] = min(cvRound(sqrt((double)d2)), bandMax);
+	}
+
+	const double minDist2 = minDist * minDist;
+	for (size_t i = 0; i < centres.size(); i++) {
+		int cx = centres[i] % edges.cols;
+		int cy = centres[i] / edges.cols;
+
+		bool close = false;
+		for (size_t j = 0; j < circles->size() && !close; j++) {
+			float ddx = (*circles)[j][0] - cx;
+			float ddy = (*circles)[j][1] - cy;
+			close = ddx*ddx + ddy*ddy < minDist2;
+		}
+		if (close)
+			continue;
+
+		float radius;
+		if (!estimateRadius(cx, cy, bandMin, bandMax, accThresh, &radius))
+			continue;
+		circles->push_back(Vec3f(cx, cy, radius));
+		if (votes != NULL)
+			votes->push_back(accum[centres[i]]);
+	}
+}
+
+const Mat &CircleHough::edgeImage() const {
+	return edges;
+}
+
+void CircleHough::detect(const Mat &gray, vector<Vec3f> *circles, double minDist, double cannyThresh,
+                         double accThresh, int minRadius, int maxRadius, int maxCircles,
+                         vector<int> *votes) {
+	circles->clear();
+	if (votes != NULL)
+		votes->clear();
+	minRadius = max(minRadius, 0);
+	if (maxRadius <= 0)
+		maxRadius = max(gray.rows, gray.cols);
+	if (maxRadius < minRadius || gray.rows < 3 || gray.cols < 3)
+		return;
+
+	findEdges(gray, cannyThresh);
+	accumulate(minRadius, maxRadius);
+	findCircles(circles, minDist, accThresh, maxCircles, votes);
+}
+
+}
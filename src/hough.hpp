@@ -0,0 +1,71 @@
+#ifndef HOUGH_HPP_
+#define HOUGH_HPP_
+
+
+#include "opencv2/core/core.hpp"
+using namespace cv;
+
+namespace track {
+
+/*
+ * A gradient Hough circle detector specialised for circles within a known,
+ * narrow radius band. Unlike HoughCircles it keeps its edge, gradient and
+ * accumulator buffers between frames, only votes along the configured band
+ * and only ranks the strongest maxCircles centres. Its output follows the
+ * conventions of HoughCircles(CV_HOUGH_GRADIENT) with dp = 1.
+ */
+class CircleHough {
+public:
+	CircleHough();
+
+	/*
+	 * Detects circles in a grayscale image, strongest first. When votes is
+	 * given it receives the accumulator votes of each circle's centre.
+	 */
+	void detect(const Mat &gray, vector<Vec3f> *circles, double minDist, double cannyThresh,
+	            double accThresh, int minRadius, int maxRadius, int maxCircles,
+	            vector<int> *votes = NULL);
+
+	/*
+	 * The stages of detect(), for callers that keep the results of the
+	 * earlier stages while only the parameters of later ones change:
+	 * findEdges() takes the Canny edges and gradients of a grayscale
+	 * image, accumulate() lets them vote for the centres within a radius
+	 * band and findCircles() picks the circles from those votes.
+	 */
+	void findEdges(const Mat &gray, double cannyThresh);
+	void accumulate(int minRadius, int maxRadius);
+	void findCircles(vector<Vec3f> *circles, double minDist, double accThresh, int maxCircles,
+	                 vector<int> *votes = NULL);
+
+	/*
+	 * The edges found by the last findEdges() call.
+	 */
+	const Mat &edgeImage() const;
+
+private:
+	void collectEdges();
+	void normalizeGradients();
+	void vote(int minRadius, int maxRadius);
+	void findCentres(double accThresh, int maxCircles);
+	bool estimateRadius(int cx, int cy, int minRadius, int maxRadius, double accThresh,
+	                    float *radius);
+
+	// views of the grow-only buffers below, sized to the current image
+	Mat edges, dx, dy;
+	Mat edgeBuf, dxBuf, dyBuf;
+
+	// edge pixels in row-major order, rowStart[y] indexes the first of row y
+	vector<int> edgeX, edgeY;
+	vector<float> gradX, gradY;
+	vector<int> rowStart;
+
+	vector<int> accum;     // empty when the last band or image was too small
+	int bandMin, bandMax;  // the radius band accum was voted for
+	vector<int> centres;
+	vector<int> hist;
+	vector<int> radiusOf;  // rounded sqrt of a squared distance
+};
+
+}
+#endif /* HOUGH_HPP_ */
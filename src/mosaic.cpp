@@ -0,0 +1,257 @@
+#include <float.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include "calib.hpp"
+#include "source.hpp"
+
+using namespace std;
+using namespace cv;
+
+// largest mosaic built, guarding against a resolution in the wrong unit
+const int MAX_CELLS = 8192 * 8192;
+
+void help() {
+	cout << "Usage: mosaic [-hl] [-r <resolution>] [-o <image>] -m <manifest>" << endl
+	     << "Description:" << endl
+	     << "  Stitches the frames of every camera of the rig into one rectified top-down" << endl
+	     << "  view of the arena. The view is built from the remap tables written by" << endl
+	     << "  gencalib next to each calibration file, once at startup, so every frame" << endl
+	     << "  only costs one table lookup per mosaic pixel." << endl
+	     << "Options:" << endl
+	     << "  -h           this help info" << endl
+	     << "  -l           loop recorded inputs" << endl
+	     << "  -m <file>    camera manifest, one \"<input> <calib>\" pair per line as read" << endl
+	     << "               by tracker (see conf/cameras.txt)" << endl
+	     << "  -o <image>   write the first mosaic to an image file instead of showing it" << endl
+	     << "  -r <units>   world units covered by one mosaic pixel (default 10)" << endl
+;
+}
+
+bool readManifest(string filename, vector<string> *inputs, vector<string> *calibs) {
+	ifstream in(filename.c_str());
+	if (!in.is_open())
+		return false;
+
+	string line;
+	while (getline(in, line)) {
+		if (line.empty() || line[0] == '#')
+			continue;
+		std::stringstream sstm(line);
+		string input;
+		string calibfile;
+		if (!(sstm >> input >> calibfile))
+			continue;
+		inputs->push_back(input);
+		calibs->push_back(calibfile);
+	}
+	return true;
+}
+
+/*
+ * A rectified top-down view of the arena stitched from several cameras.
+ * Each mosaic pixel covers resolution x resolution world units and shows
+ * the camera pixel that sees it closest to that camera's image centre,
+ * where the lens distorts least. Which pixel that is never changes, so it
+ * is looked up once from the remap tables.
+ */
+class Mosaic {
+public:
+	/*
+	 * Returns false if the tables cover no ground or too large an area.
+	 */
+	bool build(const vector<calib::RemapTable *> &tables, float resolution) {
+		Rect_<float> world;
+		for (size_t c = 0; c < tables.size(); c++) {
+			Rect_<float> b = tables[c]->bounds();
+			if (b.width <= 0 || b.height <= 0)
+				continue;
+			world = world.area() > 0 ? (world | b) : b;
+		}
+		if (world.area() <= 0 || resolution <= 0)
+			return false;
+		double cols = floor(world.width / resolution) + 1;
+		double rows = floor(world.height / resolution) + 1;
+		if (cols * rows > MAX_CELLS)
+			return false;
+		cells = Size((int)cols, (int)rows);
+		frameSizes.resize(tables.size());
+
+		// the world y axis points up, the mosaic's rows down
+		const float left = world.x;
+		const float top = world.y + world.height;
+		camera.assign(cells.area(), -1);
+		offset.assign(cells.area(), 0);
+		vector<float> best(cells.area(), FLT_MAX);
+		for (size_t c = 0; c < tables.size(); c++) {
+			const Size size = tables[c]->size();
+			frameSizes[c] = size;
+			const float cx = size.width / 2.0f;
+			const float cy = size.height / 2.0f;
+			for (int y = 0; y < size.height; y++) {
+				const Point2f *row = tables[c]->row(y);
+				for (int x = 0; x < size.width; x++) {
+					if (row[x].x != row[x].x)
+						continue;
+					int col = cvFloor((row[x].x - left) / resolution);
+					int r = cvFloor((top - row[x].y) / resolution);
+					if (col < 0 || col >= cells.width || r < 0 || r >= cells.height)
+						continue;
+					int i = r * cells.width + col;
+					float d = (x - cx)*(x - cx) + (y - cy)*(y - cy);
+					if (d < best[i]) {
+						best[i] = d;
+						camera[i] = c;
+						offset[i] = y * size.width + x;
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	Size size() const {
+		return cells;
+	}
+
+	/*
+	 * Fills out with the pixels of the cameras' current color frames.
+	 * Pixels of cameras whose frame is missing or has a different size
+	 * than their table stay black.
+	 */
+	void render(const vector<Mat> &frames, Mat *out) const {
+		out->create(cells, CV_8UC3);
+		vector<const uchar *> sources(frames.size(), (const uchar *)NULL);
+		for (size_t c = 0; c < frames.size() && c < frameSizes.size(); c++) {
+			const Mat &f = frames[c];
+			if (f.type() == CV_8UC3 && f.isContinuous() && f.size() == frameSizes[c])
+				sources[c] = f.data;
+		}
+
+		uchar *dst = out->data;
+		const int n = cells.area();
+		for (int i = 0; i < n; i++, dst += 3) {
+			int c = camera[i];
+			const uchar *src = c >= 0 ? sources[c] : NULL;
+			if (src == NULL) {
+				dst[0] = dst[1] = dst[2] = 0;
+				continue;
+			}
+			src += offset[i] * 3;
+			dst[0] = src[0];
+			dst[1] = src[1];
+			dst[2] = src[2];
+		}
+	}
+
+private:
+	Size cells;
+	vector<short> camera;  // the camera shown by each mosaic pixel or -1
+	vector<int> offset;    // the index of the pixel within that camera's frame
+	vector<Size> frameSizes;
+};
+
+int main(int argc, char** argv) {
+	vector<string> inputs;
+	vector<string> calibfiles;
+	source::Options sourceOpts;
+	float resolution = 10;
+	string outfile;
+
+	int c;
+	while ((c = getopt(argc, argv, "hlm:o:r:")) != -1) {
+		switch (c) {
+		case 'l':
+			sourceOpts.loop = true;
+			break;
+		case 'm':
+			if (!readManifest(string(optarg), &inputs, &calibfiles)) {
+				cout << "Cannot read camera manifest: " << optarg << endl;
+				return 1;
+			}
+			break;
+		case 'o':
+			outfile = string(optarg);
+			break;
+		case 'r':
+			resolution = atof(optarg);
+			break;
+		case 'h':
+			help();
+			return 0;
+		case '?':
+			cout << "Invalid arguments." << endl << endl;
+			help();
+			return 1;
+		}
+	}
+	if (inputs.empty()) {
+		cout << "No cameras specified." << endl << endl;
+		help();
+		return 1;
+	}
+
+	vector<calib::RemapTable *> tables;
+	vector<source::FrameSource *> sources;
+	for (size_t i = 0; i < inputs.size(); i++) {
+		string remapfile = calib::remapFile(calibfiles[i]);
+		calib::RemapTable *table = new calib::RemapTable();
+		if (!table->open(remapfile)) {
+			cout << "Cannot read remap table: " << remapfile << " (run gencalib to create it)" << endl;
+			return 1;
+		}
+		tables.push_back(table);
+
+		sourceOpts.width = table->size().width;
+		sourceOpts.height = table->size().height;
+		source::FrameSource *cap = source::openSource(inputs[i], sourceOpts);
+		if (cap == NULL) {
+			cout << "Cannot initialize video capturing: " << inputs[i] << endl;
+			return 1;
+		}
+		sources.push_back(cap);
+	}
+
+	Mosaic mosaic;
+	if (!mosaic.build(tables, resolution)) {
+		cout << "Cannot build a mosaic at resolution " << resolution << endl;
+		return 1;
+	}
+	cout << "Mosaic of " << mosaic.size().width << "x" << mosaic.size().height << " pixels" << endl;
+	// the lookups are all the mosaic needs from now on
+	for (size_t i = 0; i < tables.size(); i++)
+		delete tables[i];
+
+	if (outfile.empty())
+		namedWindow("Mosaic", CV_WINDOW_NORMAL | CV_WINDOW_KEEPRATIO);
+
+	vector<Mat> frames(sources.size());
+	Mat view;
+	bool running = true;
+	while (running) {
+		for (size_t i = 0; i < sources.size() && running; i++)
+			running = sources[i]->read(frames[i]);
+		if (!running)
+			break;
+
+		mosaic.render(frames, &view);
+		if (!outfile.empty()) {
+			imwrite(outfile, view);
+			cout << "Created mosaic: " << outfile << endl;
+			break;
+		}
+		imshow("Mosaic", view);
+		if (waitKey(1) == 'q')
+			break;
+	}
+
+	for (size_t i = 0; i < sources.size(); i++)
+		delete sources[i];
+	return 0;
+}
@@ -0,0 +1,54 @@
+#include "opencv2/imgproc/imgproc.hpp"
+#include "motion.hpp"
+
+using namespace std;
+using namespace cv;
+
+namespace track {
+
+MotionMask::MotionMask() : scale(8), threshold(20), rate(0.05), ready(false) {
+}
+
+void MotionMask::configure(int scale, double threshold, double rate) {
+	this->scale = MAX(scale, 1);
+	this->threshold = threshold;
+	this->rate = rate;
+	reset();
+}
+
+void MotionMask::reset() {
+	ready = false;
+}
+
+bool MotionMask::update(const Mat &img, vector<Rect> *changed) {
+	changed->clear();
+
+	// averaging down to the model size also averages out most pixel noise
+	Size area(MAX(img.cols / scale, 1), MAX(img.rows / scale, 1));
+	resize(img, small, area, 0, 0, INTER_AREA);
+	cvtColor(small, gray, CV_RGB2GRAY);
+	if (!ready || background.size() != area) {
+		gray.convertTo(background, CV_32F);
+		ready = true;
+		return false;
+	}
+
+	background.convertTo(reference, CV_8U);
+	absdiff(gray, reference, diff);
+	cv::threshold(diff, changes, threshold, 255, THRESH_BINARY);
+	// drop isolated pixels, then join the pieces of one moving object
+	erode(changes, changes, Mat());
+	dilate(changes, changes, Mat(), Point(-1, -1), 2);
+	accumulateWeighted(gray, background, rate);
+
+	// findContours overwrites its input
+	changes.copyTo(work);
+	findContours(work, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
+	for (size_t i = 0; i < contours.size(); i++) {
+		Rect r = boundingRect(contours[i]);
+		changed->push_back(Rect(r.x * scale, r.y * scale, r.width * scale, r.height * scale));
+	}
+	return true;
+}
+
+}
@@ -0,0 +1,51 @@
+#ifndef MOTION_HPP_
+#define MOTION_HPP_
+
+
+#include "opencv2/core/core.hpp"
+using namespace cv;
+
+namespace track {
+
+/*
+ * A running background model of a camera's view, kept as a greyscale image
+ * at 1/scale of the frame size. Every frame is compared to the model and
+ * then blended into it, so lighting drift and objects that stay put fade
+ * into the background after a while.
+ */
+class MotionMask {
+public:
+	MotionMask();
+
+	/*
+	 * Changes the model resolution, the grey level difference that counts
+	 * as a change and the weight of each frame in the model. Forgets the
+	 * model.
+	 */
+	void configure(int scale, double threshold, double rate);
+
+	/*
+	 * Forgets the model so that the next frame becomes the background.
+	 */
+	void reset();
+
+	/*
+	 * Compares a color image to the model, blends it in and returns the
+	 * bounding boxes of the changed areas in image coordinates. Returns
+	 * false without any boxes when there was no model to compare to yet.
+	 */
+	bool update(const Mat &img, vector<Rect> *changed);
+
+private:
+	int scale;
+	double threshold;
+	double rate;
+	bool ready;
+
+	Mat small, gray, reference, diff, changes, work;
+	Mat background;  // CV_32F
+	vector<vector<Point> > contours;
+};
+
+}
+#endif /* MOTION_HPP_ */
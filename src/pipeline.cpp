@@ -0,0 +1,133 @@
+#include <pthread.h>
+#include <unistd.h>
+#include "pipeline.hpp"
+
+namespace pipeline {
+
+FrameRing::FrameRing(int slots, Size size, int type, bool lossless)
+	: frames(slots), stamps(slots, 0), free(slots), lossless(lossless),
+	  spare(-1), latest(-1), closed(0), drops(0) {
+	for (int i = 0; i < slots; i++) {
+		frames[i].create(size, type);
+		free.push(i);
+	}
+	sem_init(&ready, 0, 0);
+	sem_init(&taken, 0, 0);
+	sem_init(&available, 0, slots);
+}
+
+FrameRing::~FrameRing() {
+	sem_destroy(&ready);
+	sem_destroy(&taken);
+	sem_destroy(&available);
+}
+
+int FrameRing::slots() const {
+	return frames.size();
+}
+
+Mat &FrameRing::frame(int slot) {
+	return frames[slot];
+}
+
+long long &FrameRing::stamp(int slot) {
+	return stamps[slot];
+}
+
+int FrameRing::acquire() {
+	if (spare >= 0) {
+		int slot = spare;
+		spare = -1;
+		return slot;
+	}
+	// the count matches the free queue, so the pop cannot fail
+	while (sem_wait(&available) != 0)
+		;
+	int slot;
+	free.pop(&slot);
+	return slot;
+}
+
+void FrameRing::publish(int slot) {
+	if (lossless) {
+		while (__atomic_load_n(&latest, __ATOMIC_ACQUIRE) != -1)
+			sem_wait(&taken);
+	}
+	int old = __atomic_exchange_n(&latest, slot, __ATOMIC_ACQ_REL);
+	if (old >= 0) {
+		// never seen by the processing thread, so capture can reuse it
+		spare = old;
+		__atomic_add_fetch(&drops, 1, __ATOMIC_RELAXED);
+	}
+	sem_post(&ready);
+}
+
+void FrameRing::close() {
+	__atomic_store_n(&closed, 1, __ATOMIC_RELEASE);
+	sem_post(&ready);
+}
+
+int FrameRing::take() {
+	while (true) {
+		int slot = __atomic_exchange_n(&latest, -1, __ATOMIC_ACQ_REL);
+		if (slot >= 0) {
+			sem_post(&taken);
+			return slot;
+		}
+		if (__atomic_load_n(&closed, __ATOMIC_ACQUIRE)) {
+			// a frame may have been published just before closing
+			slot = __atomic_exchange_n(&latest, -1, __ATOMIC_ACQ_REL);
+			if (slot >= 0)
+				sem_post(&taken);
+			return slot;
+		}
+		sem_wait(&ready);
+	}
+}
+
+void FrameRing::release(int slot) {
+	free.push(slot);
+	sem_post(&available);
+}
+
+unsigned long FrameRing::dropped() const {
+	return __atomic_load_n(&drops, __ATOMIC_RELAXED);
+}
+
+/*
+ * Work shared by the threads of parallelFor.
+ */
+struct Loop {
+	int n;
+	int next;  // the next index to run, claimed atomically
+	void (*body)(int, void *);
+	void *arg;
+};
+
+static void *runLoop(void *arg) {
+	Loop *loop = (Loop *)arg;
+	int i;
+	while ((i = __atomic_fetch_add(&loop->next, 1, __ATOMIC_RELAXED)) < loop->n)
+		loop->body(i, loop->arg);
+	return NULL;
+}
+
+void parallelFor(int n, void (*body)(int, void *), void *arg) {
+	Loop loop;
+	loop.n = n;
+	loop.next = 0;
+	loop.body = body;
+	loop.arg = arg;
+
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	int workers = cores > 0 ? (int)cores : 1;
+	if (workers > n)
+		workers = n;
+	std::vector<pthread_t> threads(workers);
+	for (int i = 0; i < workers; i++)
+		pthread_create(&threads[i], NULL, runLoop, &loop);
+	for (int i = 0; i < workers; i++)
+		pthread_join(threads[i], NULL);
+}
+
+}
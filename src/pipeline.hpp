@@ -0,0 +1,138 @@
+#ifndef PIPELINE_HPP_
+#define PIPELINE_HPP_
+
+#include <semaphore.h>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+using namespace cv;
+
+namespace pipeline {
+
+/*
+ * A bounded lock-free queue between exactly one producer thread and one
+ * consumer thread.
+ */
+template<typename T>
+class SpscQueue {
+public:
+	/*
+	 * Holds up to capacity items; capacity is rounded up to a power of two.
+	 */
+	SpscQueue(size_t capacity) : head(0), tail(0) {
+		size_t n = 1;
+		while (n < capacity)
+			n <<= 1;
+		items.resize(n);
+		mask = n - 1;
+	}
+
+	/*
+	 * Returns false if the queue is full. Producer only.
+	 */
+	bool push(const T &item) {
+		size_t t = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+		if (t - __atomic_load_n(&head, __ATOMIC_ACQUIRE) > mask)
+			return false;
+		items[t & mask] = item;
+		__atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	/*
+	 * Returns false if the queue is empty. Consumer only.
+	 */
+	bool pop(T *item) {
+		size_t h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+		if (h == __atomic_load_n(&tail, __ATOMIC_ACQUIRE))
+			return false;
+		*item = items[h & mask];
+		__atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+
+private:
+	std::vector<T> items;
+	size_t mask;
+	size_t head;  // next item to pop, written by the consumer
+	size_t tail;  // next free item, written by the producer
+};
+
+
+/*
+ * A fixed pool of preallocated frame buffers cycled between a capture
+ * thread, which fills them, and a processing thread, which always receives
+ * the most recently captured frame. A frame that is still waiting when a
+ * newer one arrives is recycled unseen ("latest frame wins"), unless the ring
+ * is lossless, in which case capture waits for processing to catch up.
+ * Slots are returned with release() once every later stage is done with
+ * them; release() must always be called from the same thread.
+ */
+class FrameRing {
+public:
+	FrameRing(int slots, Size size, int type, bool lossless = false);
+	~FrameRing();
+
+	int slots() const;
+
+	/*
+	 * The buffer of a slot and the capture time of the frame it holds.
+	 */
+	Mat &frame(int slot);
+	long long &stamp(int slot);
+
+	/*
+	 * Returns a slot to capture into, waiting for one to be released if all
+	 * are in use. Capture thread only.
+	 */
+	int acquire();
+
+	/*
+	 * Hands a filled slot to the processing thread. Capture thread only.
+	 */
+	void publish(int slot);
+
+	/*
+	 * Tells the processing thread that no more frames will be published.
+	 */
+	void close();
+
+	/*
+	 * Waits for the newest published slot. Returns -1 once the ring is
+	 * closed and drained. Processing thread only.
+	 */
+	int take();
+
+	/*
+	 * Returns a slot to the pool.
+	 */
+	void release(int slot);
+
+	/*
+	 * The number of frames recycled before they could be processed.
+	 */
+	unsigned long dropped() const;
+
+private:
+	std::vector<Mat> frames;
+	std::vector<long long> stamps;
+	SpscQueue<int> free;
+	bool lossless;
+	int spare;     // a dropped slot kept by the capture thread for reuse
+	int latest;    // the newest published slot or -1, exchanged atomically
+	int closed;
+	unsigned long drops;
+	sem_t ready;   // posted for every publish
+	sem_t taken;   // posted for every take, used by lossless rings
+	sem_t available;  // counts the slots in free
+};
+
+
+/*
+ * Calls body(i, arg) for every i in [0, n) on one thread per core and
+ * returns once all calls have finished.
+ */
+void parallelFor(int n, void (*body)(int, void *), void *arg);
+
+}
+#endif /* PIPELINE_HPP_ */
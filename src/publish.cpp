@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include "publish.hpp"
+
+namespace publish {
+
+static const int CONNECT_TIMEOUT_MS = 500;
+static const int MIN_BACKOFF_MS = 100;
+static const int MAX_BACKOFF_MS = 2000;
+
+static timespec deadline(int ms) {
+	timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	return ts;
+}
+
+Publisher::Publisher(string host, int port, size_t capacity)
+	: host(host), port(port), capacity(capacity > 0 ? capacity : 1), redisc(NULL),
+	  drops(0), started(false), stopping(false) {
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&cond, NULL);
+}
+
+Publisher::~Publisher() {
+	stop();
+	disconnect();
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&lock);
+}
+
+bool Publisher::start() {
+	if (started)
+		return true;
+	if (!connect())
+		return false;
+	stopping = false;
+	started = pthread_create(&thread, NULL, run, this) == 0;
+	return started;
+}
+
+void Publisher::stop() {
+	if (!started)
+		return;
+	pthread_mutex_lock(&lock);
+	stopping = true;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+	pthread_join(thread, NULL);
+	started = false;
+}
+
+void Publisher::send(const Message &msg) {
+	pthread_mutex_lock(&lock);
+	if (queue.size() >= capacity) {
+		queue.pop_front();
+		drops++;
+	}
+	queue.push_back(msg);
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+void Publisher::set(const string &key, const string &value) {
+	Command cmd(3);
+	cmd[0] = "SET";
+	cmd[1] = key;
+	cmd[2] = value;
+	send(Message(1, cmd));
+}
+
+unsigned long Publisher::dropped() {
+	pthread_mutex_lock(&lock);
+	unsigned long n = drops;
+	pthread_mutex_unlock(&lock);
+	return n;
+}
+
+bool Publisher::connect() {
+	timeval tv;
+	tv.tv_sec = CONNECT_TIMEOUT_MS / 1000;
+	tv.tv_usec = (CONNECT_TIMEOUT_MS % 1000) * 1000;
+
+	redisc = redisConnectWithTimeout(host.c_str(), port, tv);
+	if (redisc == NULL || redisc->err) {
+		printf("Redis connection error: %s\n", redisc ? redisc->errstr : "out of memory");
+		disconnect();
+		return false;
+	}
+	// a stalled server must not wedge the sender thread forever
+	redisSetTimeout(redisc, tv);
+	return true;
+}
+
+void Publisher::disconnect() {
+	if (redisc != NULL)
+		redisFree(redisc);
+	redisc = NULL;
+}
+
+/*
+ * Pipelines every command of the batch and then collects the replies.
+ */
+bool Publisher::flush(const deque<Message> &batch) {
+	size_t pending = 0;
+	vector<const char *> argv;
+	vector<size_t> argvlen;
+	for (size_t m = 0; m < batch.size(); m++) {
+		for (size_t c = 0; c < batch[m].size(); c++) {
+			const Command &cmd = batch[m][c];
+			argv.resize(cmd.size());
+			argvlen.resize(cmd.size());
+			for (size_t i = 0; i < cmd.size(); i++) {
+				argv[i] = cmd[i].data();
+				argvlen[i] = cmd[i].size();
+			}
+			if (redisAppendCommandArgv(redisc, cmd.size(), &argv[0], &argvlen[0]) != REDIS_OK)
+				return false;
+			pending++;
+		}
+	}
+
+	for (size_t i = 0; i < pending; i++) {
+		void *reply = NULL;
+		if (redisGetReply(redisc, &reply) != REDIS_OK) {
+			printf("Redis error: %s\n", redisc->errstr);
+			return false;
+		}
+		if (((redisReply *)reply)->type == REDIS_REPLY_ERROR)
+			printf("Redis error reply: %s\n", ((redisReply *)reply)->str);
+		freeReplyObject(reply);
+	}
+	return true;
+}
+
+void *Publisher::run(void *arg) {
+	Publisher *p = (Publisher *)arg;
+	deque<Message> batch;
+	int backoff = MIN_BACKOFF_MS;
+
+	pthread_mutex_lock(&p->lock);
+	while (true) {
+		while (p->queue.empty() && !p->stopping)
+			pthread_cond_wait(&p->cond, &p->lock);
+		if (p->queue.empty() && p->stopping)
+			break;
+
+		if (p->redisc == NULL) {
+			// retry with exponential backoff; messages keep queueing (and
+			// dropping) in the meantime
+			pthread_mutex_unlock(&p->lock);
+			bool ok = p->connect();
+			pthread_mutex_lock(&p->lock);
+			if (!ok) {
+				if (p->stopping) {
+					p->drops += p->queue.size();
+					p->queue.clear();
+					break;
+				}
+				timespec ts = deadline(backoff);
+				while (!p->stopping && pthread_cond_timedwait(&p->cond, &p->lock, &ts) != ETIMEDOUT)
+					;
+				backoff = backoff * 2 > MAX_BACKOFF_MS ? MAX_BACKOFF_MS : backoff * 2;
+				continue;
+			}
+			backoff = MIN_BACKOFF_MS;
+		}
+
+		batch.swap(p->queue);
+		pthread_mutex_unlock(&p->lock);
+
+		bool ok = p->flush(batch);
+		if (!ok)
+			p->disconnect();
+
+		pthread_mutex_lock(&p->lock);
+		if (!ok)
+			p->drops += batch.size();
+		batch.clear();
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+}
@@ -0,0 +1,85 @@
+#ifndef PUBLISH_HPP_
+#define PUBLISH_HPP_
+
+#include <pthread.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <hiredis/hiredis.h>
+
+using namespace std;
+
+namespace publish {
+
+/*
+ * A single redis command split into its arguments, e.g. {"SET", "camera0", "1 2"}.
+ */
+typedef vector<string> Command;
+
+/*
+ * A group of commands that are always sent together, e.g. everything
+ * produced for one frame.
+ */
+typedef vector<Command> Message;
+
+/*
+ * Sends messages to redis from a background thread so that callers never
+ * wait on the network. Queued messages are pipelined to the server and
+ * the connection is re-established automatically when it drops. When the
+ * queue is full the oldest unsent message is discarded.
+ */
+class Publisher {
+public:
+	Publisher(string host, int port, size_t capacity = 64);
+	~Publisher();
+
+	/*
+	 * Connects to the server and starts the sender thread. Returns false if
+	 * the initial connection fails.
+	 */
+	bool start();
+
+	/*
+	 * Flushes the queue and stops the sender thread.
+	 */
+	void stop();
+
+	/*
+	 * Queues a message for sending. Never blocks on the network.
+	 */
+	void send(const Message &msg);
+
+	/*
+	 * Queues a single SET command.
+	 */
+	void set(const string &key, const string &value);
+
+	/*
+	 * The number of messages discarded because the queue was full or the
+	 * connection was down.
+	 */
+	unsigned long dropped();
+
+private:
+	static void *run(void *arg);
+	bool connect();
+	void disconnect();
+	bool flush(const deque<Message> &batch);
+
+	string host;
+	int port;
+	size_t capacity;
+	redisContext *redisc;
+
+	pthread_t thread;
+	pthread_mutex_t lock;  // guards everything below
+	pthread_cond_t cond;
+	deque<Message> queue;
+	unsigned long drops;
+	bool started;
+	bool stopping;
+};
+
+}
+#endif /* PUBLISH_HPP_ */
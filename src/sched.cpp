@@ -0,0 +1,144 @@
+#include <algorithm>
+#include "sched.hpp"
+
+using namespace std;
+
+namespace sched {
+
+const char *levelNames[NUM_LEVELS] = { "full", "roi", "coarse" };
+
+static const double ONE_CORE = 1e9;     // CPU ns per second of one thread
+static const double SMOOTHING = 0.2;    // weight of the newest frame in the averages
+static const int HOLDOFF = 10;          // frames between two changes
+static const double TARGET = 0.9;       // load a stretched period is sized for
+static const double RESTORE = 0.7;      // load below which the rate or a level is restored
+static const double AGING = 0.9;        // decay of a level's cost each time it is not restored
+static const int MAX_STRETCH = 4;       // the longest period, in base periods
+
+Budget::Budget(double cores, int cameras) : total(cores * ONE_CORE), demands(cameras, 0) {
+	pthread_mutex_init(&lock, NULL);
+}
+
+Budget::~Budget() {
+	pthread_mutex_destroy(&lock);
+}
+
+void Budget::demand(int camera, double nsPerSecond) {
+	pthread_mutex_lock(&lock);
+	demands[camera] = nsPerSecond;
+	pthread_mutex_unlock(&lock);
+}
+
+double Budget::share(int camera) {
+	pthread_mutex_lock(&lock);
+	sorted = demands;
+	sort(sorted.begin(), sorted.end());
+
+	// satisfy the smallest demands while they fit an equal split of the rest
+	const size_t n = sorted.size();
+	double left = total;
+	size_t i = 0;
+	while (i < n && sorted[i] * (n - i) <= left)
+		left -= sorted[i++];
+
+	double d = demands[camera];
+	double s;
+	if (i == n)
+		s = d + left / n;  // everyone fits, the spare is split evenly
+	else
+		s = min(d, left / (n - i));
+	pthread_mutex_unlock(&lock);
+	return min(s, ONE_CORE);
+}
+
+Scheduler::Scheduler(Budget *budget, int camera, double fps, bool hasRoi)
+	: budget(budget), camera(camera), basePeriod(fps > 0 ? (long long)(1e9 / fps) : 0),
+	  stretched(basePeriod), hasRoi(hasRoi), current(LEVEL_FULL), load(0), sinceChange(0) {
+	for (int i = 0; i < NUM_LEVELS; i++)
+		cost[i] = 0;
+}
+
+Level Scheduler::level() const {
+	return current;
+}
+
+long long Scheduler::period() const {
+	return stretched;
+}
+
+bool Scheduler::fresh(long long stamp, long long now) const {
+	return basePeriod <= 0 || now - stamp < 2 * stretched;
+}
+
+/*
+ * The level below or above the current one, skipping LEVEL_ROI without
+ * windows to search.
+ */
+Level Scheduler::step(int dir) const {
+	int l = current + dir;
+	if (l == LEVEL_ROI && !hasRoi)
+		l += dir;
+	return (Level)l;
+}
+
+void Scheduler::done(long long ns) {
+	if (basePeriod <= 0)
+		return;
+
+	double &c = cost[current];
+	c = c > 0 ? c + SMOOTHING * (ns - c) : ns;
+
+	// the demand is what full quality at the target rate would take
+	double full = cost[LEVEL_FULL] > 0 ? cost[LEVEL_FULL] : c;
+	budget->demand(camera, full * 1e9 / basePeriod);
+	double allowance = budget->share(camera) * stretched / 1e9;
+
+	double ratio = ns / max(allowance, 1.0);
+	load = sinceChange > 0 ? load + SMOOTHING * (ratio - load) : ratio;
+	if (++sinceChange < HOLDOFF)
+		return;
+
+	if (load > 1)
+		shed();
+	else if (load < RESTORE)
+		recover(allowance);
+}
+
+/*
+ * Steps down a level, or once at the lowest stretches the period so that
+ * the frames fit the allowance again.
+ */
+void Scheduler::shed() {
+	if (current < LEVEL_COARSE) {
+		current = step(1);
+	} else {
+		long long longest = MAX_STRETCH * basePeriod;
+		if (stretched >= longest)
+			return;
+		stretched = min((long long)(stretched * load / TARGET), longest);
+	}
+	sinceChange = 0;
+}
+
+/*
+ * Shortens a stretched period back towards the base period, then steps up
+ * a level whose last known cost fits the allowance.
+ */
+void Scheduler::recover(double allowance) {
+	if (stretched > basePeriod) {
+		stretched = max((long long)(stretched * load / TARGET), basePeriod);
+	} else if (current > LEVEL_FULL) {
+		double &up = cost[step(-1)];
+		if (up > allowance) {
+			// costs change with the scene, so an old estimate slowly loses weight
+			up *= AGING;
+			return;
+		}
+		current = step(-1);
+	} else {
+		return;
+	}
+	sinceChange = 0;
+}
+
+}
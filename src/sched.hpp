@@ -0,0 +1,102 @@
+#ifndef SCHED_HPP_
+#define SCHED_HPP_
+
+#include <pthread.h>
+#include <vector>
+
+namespace sched {
+
+/*
+ * How much work a frame gets, from the most to the least.
+ */
+enum Level {
+	LEVEL_FULL,    // the configured detection, with its periodic full-frame rescans
+	LEVEL_ROI,     // only the windows around known targets
+	LEVEL_COARSE,  // the windows only, on a coarser pyramid level
+	NUM_LEVELS
+};
+
+extern const char *levelNames[NUM_LEVELS];
+
+/*
+ * Divides a CPU budget between the cameras of a host. Each camera states
+ * what it would use at full quality and its target rate; cameras needing
+ * less than an equal share keep what they need and the rest is split
+ * evenly among the others (max-min fairness). No camera gets more than
+ * the one core its detection thread can use.
+ */
+class Budget {
+public:
+	Budget(double cores, int cameras);
+	~Budget();
+
+	/*
+	 * Updates the CPU nanoseconds per second a camera asks for.
+	 */
+	void demand(int camera, double nsPerSecond);
+
+	/*
+	 * The CPU nanoseconds per second a camera may use.
+	 */
+	double share(int camera);
+
+private:
+	pthread_mutex_t lock;  // guards demands
+	double total;
+	std::vector<double> demands;
+	std::vector<double> sorted;
+};
+
+/*
+ * Paces the detection of one camera and sheds load when its frames cost
+ * more CPU than its share of the budget allows. Over budget it first
+ * steps down the levels and then stretches the period between frames, so
+ * fewer but fresh frames are processed instead of falling behind. Once the
+ * load eases it restores the rate first and then the levels, each only
+ * once its last known cost fits. Nothing changes until a few frames have
+ * run since the last change, so a single slow frame does not cause one.
+ */
+class Scheduler {
+public:
+	/*
+	 * hasRoi tells whether the detector tracks windows, without which
+	 * LEVEL_ROI would be no cheaper than LEVEL_FULL and is skipped.
+	 */
+	Scheduler(Budget *budget, int camera, double fps, bool hasRoi);
+
+	Level level() const;
+
+	/*
+	 * The wall time from the start of one frame to the start of the next.
+	 */
+	long long period() const;
+
+	/*
+	 * Tests whether a frame captured at stamp is still worth processing at
+	 * now, i.e. it is less than two periods old.
+	 */
+	bool fresh(long long stamp, long long now) const;
+
+	/*
+	 * Records the CPU time a frame took at the current level and adapts.
+	 */
+	void done(long long ns);
+
+private:
+	Level step(int dir) const;
+	void shed();
+	void recover(double allowance);
+
+	Budget *budget;
+	int camera;
+	long long basePeriod;
+	long long stretched;  // the current period, at least basePeriod
+	bool hasRoi;
+	Level current;
+	double load;              // smoothed frame cost relative to the allowance
+	double cost[NUM_LEVELS];  // smoothed frame cost at each level, 0 until known
+	int sinceChange;          // frames since the level or period changed
+};
+
+}
+#endif /* SCHED_HPP_ */
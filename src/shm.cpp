@@ -0,0 +1,231 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "shm.hpp"
+
+namespace shm {
+
+static const char MAGIC[8] = { 'S', 'H', 'M', 'R', 'I', 'N', 'G', '1' };
+
+// outcomes of reading one record
+static const int READ_OK = 0;
+static const int READ_PENDING = 1;      // not written yet
+static const int READ_OVERWRITTEN = 2;  // the writer has lapped the reader
+
+/*
+ * A slot of the ring. seq is 2n + 1 while record n is being written into it
+ * and 2n + 2 once the record is complete.
+ */
+struct Slot {
+	unsigned long long seq;
+	Record record;
+};
+
+/*
+ * The header at the start of the shared memory, followed by the slots.
+ * head, the only field that changes, has a cache line to itself.
+ */
+struct Ring {
+	char magic[8];  // set last, once the rest is initialised
+	unsigned slots;
+	unsigned recordSize;
+	char pad[48];
+	unsigned long long head;  // records written so far
+	char pad2[56];
+};
+
+static Slot *slotsOf(Ring *ring) {
+	return (Slot *)(ring + 1);
+}
+
+static const Slot *slotsOf(const Ring *ring) {
+	return (const Slot *)(ring + 1);
+}
+
+static long long now() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+string ringName(int camera) {
+	char name[64];
+	snprintf(name, sizeof(name), "/tracker-camera%d", camera);
+	return string(name);
+}
+
+Writer::Writer() : ring(NULL), length(0) {
+}
+
+Writer::~Writer() {
+	close();
+}
+
+bool Writer::create(string name, unsigned slots) {
+	close();
+	unsigned n = 1;
+	while (n < slots)
+		n <<= 1;
+
+	// readers still mapping an old ring keep it until they reopen
+	shm_unlink(name.c_str());
+	int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0)
+		return false;
+	size_t size = sizeof(Ring) + n * sizeof(Slot);
+	void *data = MAP_FAILED;
+	if (ftruncate(fd, size) == 0)
+		data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED) {
+		shm_unlink(name.c_str());
+		return false;
+	}
+
+	// ftruncate zeroed every slot, so no record looks complete yet
+	ring = (Ring *)data;
+	ring->slots = n;
+	ring->recordSize = sizeof(Record);
+	ring->head = 0;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(ring->magic, MAGIC, sizeof(MAGIC));
+	this->name = name;
+	length = size;
+	return true;
+}
+
+void Writer::close() {
+	if (ring == NULL)
+		return;
+	munmap(ring, length);
+	shm_unlink(name.c_str());
+	ring = NULL;
+	length = 0;
+}
+
+void Writer::write(const Record &record) {
+	if (ring == NULL)
+		return;
+	unsigned long long n = ring->head;
+	Slot &slot = slotsOf(ring)[n & (ring->slots - 1)];
+
+	__atomic_store_n(&slot.seq, 2*n + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&slot.record, &record, sizeof(Record));
+	slot.record.seq = n;
+	slot.record.published = now();
+	__atomic_store_n(&slot.seq, 2*n + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->head, n + 1, __ATOMIC_RELEASE);
+}
+
+Reader::Reader() : ring(NULL), length(0), cursor(0), losses(0) {
+}
+
+Reader::~Reader() {
+	close();
+}
+
+bool Reader::open(string name) {
+	close();
+	int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	void *data = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(Ring))
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED)
+		return false;
+
+	const Ring *r = (const Ring *)data;
+	bool valid = memcmp(r->magic, MAGIC, sizeof(MAGIC)) == 0;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	valid = valid && r->recordSize == sizeof(Record) && r->slots > 0 && (r->slots & (r->slots - 1)) == 0
+	        && (size_t)st.st_size >= sizeof(Ring) + r->slots * sizeof(Slot);
+	if (!valid) {
+		munmap(data, st.st_size);
+		return false;
+	}
+	ring = r;
+	length = st.st_size;
+	cursor = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	losses = 0;
+	return true;
+}
+
+void Reader::close() {
+	if (ring != NULL)
+		munmap((void *)ring, length);
+	ring = NULL;
+	length = 0;
+}
+
+bool Reader::empty() const {
+	return ring == NULL;
+}
+
+/*
+ * Copies record n if its slot still holds it, seqlock style.
+ */
+int Reader::read(unsigned long long n, Record *record) const {
+	const Slot &slot = slotsOf(ring)[n & (ring->slots - 1)];
+	const unsigned long long expected = 2*n + 2;
+	unsigned long long before = __atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE);
+	if (before != expected)
+		return before < expected ? READ_PENDING : READ_OVERWRITTEN;
+	memcpy(record, &slot.record, sizeof(Record));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	unsigned long long after = __atomic_load_n(&slot.seq, __ATOMIC_RELAXED);
+	return after == expected ? READ_OK : READ_OVERWRITTEN;
+}
+
+bool Reader::next(Record *record) {
+	if (ring == NULL)
+		return false;
+	while (true) {
+		unsigned long long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (cursor >= head)
+			return false;
+		if (head - cursor > ring->slots) {
+			losses += head - ring->slots - cursor;
+			cursor = head - ring->slots;
+		}
+		int result = read(cursor, record);
+		if (result == READ_PENDING)
+			return false;
+		if (result == READ_OK) {
+			cursor++;
+			return true;
+		}
+		// overwritten while copying; catch up with the writer and try again
+		losses++;
+		cursor++;
+	}
+}
+
+bool Reader::latest(Record *record) {
+	if (ring == NULL)
+		return false;
+	while (true) {
+		unsigned long long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (cursor >= head)
+			return false;
+		losses += head - 1 - cursor;
+		cursor = head - 1;
+		if (read(cursor, record) == READ_OK) {
+			cursor++;
+			return true;
+		}
+	}
+}
+
+unsigned long long Reader::lost() const {
+	return losses;
+}
+
+}
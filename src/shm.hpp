@@ -0,0 +1,134 @@
+#ifndef SHM_HPP_
+#define SHM_HPP_
+
+#include <string>
+
+using namespace std;
+
+namespace shm {
+
+// positions a record holds; the rest of a crowded frame is left out
+const int MAX_POSITIONS = 64;
+
+/*
+ * A target seen in a frame, in world coordinates when the camera is
+ * calibrated.
+ */
+struct Position {
+	float x;
+	float y;
+	int id;  // the target's stable ID
+};
+
+/*
+ * The positions found in one frame. Records have a fixed size so that they
+ * can be copied in and out of the ring without any parsing.
+ */
+struct Record {
+	unsigned long long seq;    // records written to the ring before this one
+	long long captured;        // capture time, CLOCK_MONOTONIC nanoseconds
+	long long published;       // time the record was written, same clock
+	int camera;
+	int found;                 // positions found in the frame
+	int count;                 // positions held, at most MAX_POSITIONS
+	Position positions[MAX_POSITIONS];
+};
+
+/*
+ * The ring of records shared by a Writer and its Readers.
+ */
+struct Ring;
+
+/*
+ * The name of the ring a tracker camera writes, e.g. "/tracker-camera0".
+ */
+string ringName(int camera);
+
+/*
+ * Publishes records into a ring in POSIX shared memory, for readers on the
+ * same host. There is exactly one writer per ring and it never waits on
+ * its readers: a reader that falls more than a ring behind loses the
+ * records that were overwritten.
+ */
+class Writer {
+public:
+	Writer();
+	~Writer();
+
+	/*
+	 * Creates the ring, replacing any left behind by an earlier writer.
+	 * slots is rounded up to a power of two. Returns false on failure.
+	 */
+	bool create(string name, unsigned slots = 64);
+
+	/*
+	 * Removes the ring. Readers keep what they have mapped.
+	 */
+	void close();
+
+	/*
+	 * Appends a record, overwriting the oldest one once the ring is full.
+	 * The record's sequence number is assigned by the ring.
+	 */
+	void write(const Record &record);
+
+private:
+	Writer(const Writer &);
+	Writer &operator=(const Writer &);
+
+	string name;
+	Ring *ring;
+	size_t length;
+};
+
+/*
+ * Reads the records of a ring in shared memory. Every slot is guarded by a
+ * sequence number that is odd while the writer is filling it, so a reader
+ * copies a record and then checks that the sequence number did not change,
+ * retrying otherwise; readers never write to the ring and any number of
+ * them may read it at once.
+ */
+class Reader {
+public:
+	Reader();
+	~Reader();
+
+	/*
+	 * Maps an existing ring. Reading starts with the next record written.
+	 * Returns false if there is no valid ring of that name.
+	 */
+	bool open(string name);
+	void close();
+
+	bool empty() const;
+
+	/*
+	 * Copies the oldest record not read yet. Returns false if there is none.
+	 */
+	bool next(Record *record);
+
+	/*
+	 * Copies the newest record, skipping every older one. Returns false if
+	 * nothing was written since the last record read.
+	 */
+	bool latest(Record *record);
+
+	/*
+	 * The number of records overwritten before they could be read.
+	 */
+	unsigned long long lost() const;
+
+private:
+	Reader(const Reader &);
+	Reader &operator=(const Reader &);
+
+	int read(unsigned long long n, Record *record) const;
+
+	const Ring *ring;
+	size_t length;
+	unsigned long long cursor;  // the next record to read
+	unsigned long long losses;
+};
+
+}
+#endif /* SHM_HPP_ */
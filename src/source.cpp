@@ -0,0 +1,238 @@
+#include <dirent.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <ctype.h>
+#include <algorithm>
+#include <fstream>
+#include <stdio.h>
+#include "source.hpp"
+
+using namespace std;
+using namespace cv;
+
+namespace source {
+
+static const char *imageExtensions[] = { ".jpg", ".jpeg", ".png", ".bmp", ".ppm", ".pgm", ".tif", ".tiff" };
+
+static long long nanos() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static bool isImage(string filename) {
+	size_t dot = filename.rfind('.');
+	if (dot == string::npos)
+		return false;
+	string ext = filename.substr(dot);
+	transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	for (size_t i = 0; i < sizeof(imageExtensions) / sizeof(imageExtensions[0]); i++)
+		if (ext == imageExtensions[i])
+			return true;
+	return false;
+}
+
+static bool isDirectory(string path) {
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static bool hasEnding(string const &fullString, string const &ending) {
+	return fullString.length() >= ending.length()
+	       && 0 == fullString.compare(fullString.length() - ending.length(), ending.length(), ending);
+}
+
+static void listImages(string dir, vector<string> *files) {
+	DIR *d = opendir(dir.c_str());
+	if (d == NULL)
+		return;
+	struct dirent *entry;
+	while ((entry = readdir(d)) != NULL) {
+		string name(entry->d_name);
+		if (isImage(name))
+			files->push_back(dir + "/" + name);
+	}
+	closedir(d);
+	sort(files->begin(), files->end());
+}
+
+static void readList(string filename, vector<string> *files) {
+	ifstream in(filename.c_str());
+	string line;
+	while (getline(in, line)) {
+		if (line.empty() || line[0] == '#')
+			continue;
+		files->push_back(line);
+	}
+}
+
+Options::Options()
+	: width(1600), height(1200), pacing(FAST), fps(20), loop(false) {
+}
+
+FrameSource::~FrameSource() {
+}
+
+DeviceSource::DeviceSource(int device, int width, int height) : cap(device) {
+	if (cap.isOpened()) {
+		cap.set(CV_CAP_PROP_FRAME_WIDTH, width);
+		cap.set(CV_CAP_PROP_FRAME_HEIGHT, height);
+	}
+}
+
+bool DeviceSource::isOpened() const {
+	return cap.isOpened();
+}
+
+bool DeviceSource::read(Mat &frame) {
+	return cap.read(frame);
+}
+
+bool DeviceSource::live() const {
+	return true;
+}
+
+Pacer::Pacer(double fps) : interval(fps > 0 ? (long long)(1e9 / fps) : 0), next(0) {
+}
+
+void Pacer::wait() {
+	long long now = nanos();
+	if (next == 0 || now - next > interval)
+		next = now;  // first frame, or we fell behind: don't try to catch up
+	timespec ts;
+	ts.tv_sec = next / 1000000000LL;
+	ts.tv_nsec = next % 1000000000LL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+	next += interval;
+}
+
+VideoFileSource::VideoFileSource(string filename, const Options &opts)
+	: filename(filename), loop(opts.loop), cap(filename), pacer(NULL) {
+	if (opts.pacing == REALTIME) {
+		double fps = cap.isOpened() ? cap.get(CV_CAP_PROP_FPS) : 0;
+		pacer = new Pacer(fps > 0 ? fps : opts.fps);
+	}
+}
+
+VideoFileSource::~VideoFileSource() {
+	delete pacer;
+}
+
+bool VideoFileSource::isOpened() const {
+	return cap.isOpened();
+}
+
+bool VideoFileSource::read(Mat &frame) {
+	if (!cap.read(frame)) {
+		if (!loop || !cap.open(filename) || !cap.read(frame))
+			return false;
+	}
+	if (pacer != NULL)
+		pacer->wait();
+	return true;
+}
+
+bool VideoFileSource::live() const {
+	return false;
+}
+
+ImageSetSource::ImageSetSource(const vector<string> &files, const Options &opts)
+	: files(files), next(0), loop(opts.loop), pacer(NULL) {
+	if (opts.pacing == REALTIME)
+		pacer = new Pacer(opts.fps);
+}
+
+ImageSetSource::~ImageSetSource() {
+	delete pacer;
+}
+
+bool ImageSetSource::isOpened() const {
+	return !files.empty();
+}
+
+bool ImageSetSource::read(Mat &frame) {
+	if (next >= files.size()) {
+		if (!loop || files.empty())
+			return false;
+		next = 0;
+	}
+	frame = imread(files[next++], 1);
+	if (frame.empty())
+		return false;
+	if (pacer != NULL)
+		pacer->wait();
+	return true;
+}
+
+bool ImageSetSource::live() const {
+	return false;
+}
+
+SyntheticSource::SyntheticSource(const synth::Options &arena, const Options &opts)
+	: arena(arena), pacer(NULL) {
+	if (opts.pacing == REALTIME)
+		pacer = new Pacer(opts.fps);
+}
+
+SyntheticSource::~SyntheticSource() {
+	delete pacer;
+}
+
+bool SyntheticSource::isOpened() const {
+	return true;
+}
+
+bool SyntheticSource::read(Mat &frame) {
+	arena.next(frame);
+	if (pacer != NULL)
+		pacer->wait();
+	return true;
+}
+
+bool SyntheticSource::live() const {
+	return false;
+}
+
+bool isDevice(string spec) {
+	if (spec.empty())
+		return false;
+	char *end;
+	strtol(spec.c_str(), &end, 10);
+	return *end == '\0';
+}
+
+FrameSource *openSource(string spec, const Options &opts) {
+	FrameSource *src;
+	synth::Options arena;
+	if (sscanf(spec.c_str(), "synth:%d,%u", &arena.robots, &arena.seed) >= 1) {
+		arena.width = opts.width;
+		arena.height = opts.height;
+		arena.fps = opts.fps;
+		src = new SyntheticSource(arena, opts);
+	} else if (isDevice(spec)) {
+		src = new DeviceSource(atoi(spec.c_str()), opts.width, opts.height);
+	} else if (isDirectory(spec)) {
+		vector<string> files;
+		listImages(spec, &files);
+		src = new ImageSetSource(files, opts);
+	} else if (hasEnding(spec, ".txt")) {
+		vector<string> files;
+		readList(spec, &files);
+		src = new ImageSetSource(files, opts);
+	} else if (isImage(spec)) {
+		src = new ImageSetSource(vector<string>(1, spec), opts);
+	} else {
+		src = new VideoFileSource(spec, opts);
+	}
+
+	if (!src->isOpened()) {
+		delete src;
+		return NULL;
+	}
+	return src;
+}
+
+}
@@ -0,0 +1,158 @@
+#ifndef SOURCE_HPP_
+#define SOURCE_HPP_
+
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include "synth.hpp"
+using namespace cv;
+
+namespace source {
+
+/*
+ * How recorded frames are delivered: as fast as they can be decoded, or at
+ * the rate they were recorded.
+ */
+enum Pacing { FAST, REALTIME };
+
+/*
+ * Settings used when opening a frame source.
+ */
+struct Options {
+	int width;      // requested capture size of live devices
+	int height;
+	Pacing pacing;  // pacing of recorded sources
+	double fps;     // replay rate when the recording does not provide one
+	bool loop;      // restart recorded sources at the end
+
+	Options();
+};
+
+
+/*
+ * A stream of frames from a camera or a recording.
+ */
+class FrameSource {
+public:
+	virtual ~FrameSource();
+
+	virtual bool isOpened() const = 0;
+
+	/*
+	 * Reads the next frame. Returns false at the end of the input.
+	 */
+	virtual bool read(Mat &frame) = 0;
+
+	/*
+	 * True for live cameras, which deliver frames at their own rate.
+	 */
+	virtual bool live() const = 0;
+};
+
+
+/*
+ * A live video input device.
+ */
+class DeviceSource : public FrameSource {
+public:
+	DeviceSource(int device, int width, int height);
+	bool isOpened() const;
+	bool read(Mat &frame);
+	bool live() const;
+
+private:
+	VideoCapture cap;
+};
+
+
+/*
+ * Releases frames no faster than a fixed rate.
+ */
+class Pacer {
+public:
+	Pacer(double fps);
+	void wait();
+
+private:
+	long long interval;
+	long long next;
+};
+
+
+/*
+ * A recorded video file.
+ */
+class VideoFileSource : public FrameSource {
+public:
+	VideoFileSource(string filename, const Options &opts);
+	~VideoFileSource();
+	bool isOpened() const;
+	bool read(Mat &frame);
+	bool live() const;
+
+private:
+	string filename;
+	bool loop;
+	VideoCapture cap;
+	Pacer *pacer;
+};
+
+
+/*
+ * A sequence of still images, e.g. a directory of recorded frames or the
+ * calibration images in conf/.
+ */
+class ImageSetSource : public FrameSource {
+public:
+	ImageSetSource(const vector<string> &files, const Options &opts);
+	~ImageSetSource();
+	bool isOpened() const;
+	bool read(Mat &frame);
+	bool live() const;
+
+private:
+	vector<string> files;
+	size_t next;
+	bool loop;
+	Pacer *pacer;
+};
+
+
+/*
+ * Frames rendered on the fly by the synthetic arena generator, which never
+ * ends. Runs the same simulation as gensynth with the same seed, so its
+ * ground truth can be written by gensynth.
+ */
+class SyntheticSource : public FrameSource {
+public:
+	SyntheticSource(const synth::Options &arena, const Options &opts);
+	~SyntheticSource();
+	bool isOpened() const;
+	bool read(Mat &frame);
+	bool live() const;
+
+private:
+	synth::Arena arena;
+	Pacer *pacer;
+};
+
+
+/*
+ * Opens a frame source from its specification:
+ *   <num>       live video input device
+ *   <dir>       every image in the directory, in name order
+ *   <file.txt>  image files listed one per line
+ *   <image>     a single image (.jpg, .png, ...)
+ *   synth:<robots>[,<seed>]  a synthetic arena with that many robots
+ *   <file>      anything else is opened as a video file
+ * Returns NULL if the source cannot be opened.
+ */
+FrameSource *openSource(string spec, const Options &opts);
+
+/*
+ * Tests whether a specification names a live video input device.
+ */
+bool isDevice(string spec);
+
+}
+#endif /* SOURCE_HPP_ */
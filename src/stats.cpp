@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <time.h>
+#include "stats.hpp"
+
+namespace stats {
+
+static const int FIRST_SHIFT = 10;  // the first bucket ends at 2^10 ns
+
+long long nanos() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+long long wallNanos() {
+	timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+long long cpuNanos() {
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+Histogram::Histogram() : samples(0), sum(0), longest(0) {
+	for (int i = 0; i < BUCKETS; i++)
+		counts[i] = 0;
+}
+
+void Histogram::add(long long ns) {
+	if (ns < 0)
+		ns = 0;
+	int i = 0;
+	for (long long bound = 1LL << FIRST_SHIFT; i < BUCKETS - 1 && ns >= bound; bound <<= 1)
+		i++;
+
+	// single writer: plain read-modify-write, atomic stores for the readers
+	__atomic_store_n(&counts[i], counts[i] + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&sum, sum + ns, __ATOMIC_RELAXED);
+	if (ns > longest)
+		__atomic_store_n(&longest, ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&samples, samples + 1, __ATOMIC_RELEASE);
+}
+
+unsigned long Histogram::count() const {
+	return __atomic_load_n(&samples, __ATOMIC_ACQUIRE);
+}
+
+long long Histogram::total() const {
+	return __atomic_load_n(&sum, __ATOMIC_RELAXED);
+}
+
+long long Histogram::max() const {
+	return __atomic_load_n(&longest, __ATOMIC_RELAXED);
+}
+
+unsigned long Histogram::bucket(int i) const {
+	return __atomic_load_n(&counts[i], __ATOMIC_RELAXED);
+}
+
+long long Histogram::upperBound(int i) {
+	return 1LL << (FIRST_SHIFT + i);
+}
+
+long long Histogram::percentile(double p) const {
+	unsigned long n = 0;
+	unsigned long c[BUCKETS];
+	for (int i = 0; i < BUCKETS; i++) {
+		c[i] = bucket(i);
+		n += c[i];
+	}
+	if (n == 0)
+		return 0;
+
+	unsigned long rank = (unsigned long)(p / 100.0 * n + 0.5);
+	if (rank < 1)
+		rank = 1;
+	unsigned long seen = 0;
+	for (int i = 0; i < BUCKETS - 1; i++) {
+		seen += c[i];
+		if (seen >= rank)
+			return upperBound(i);
+	}
+	return max();
+}
+
+string Histogram::summary() const {
+	unsigned long n = count();
+	char buf[128];
+	snprintf(buf, sizeof(buf), "%lu %lld %lld %lld %lld %lld", n, n > 0 ? total() / (long long)n / 1000 : 0,
+	         percentile(50) / 1000, percentile(90) / 1000, percentile(99) / 1000, max() / 1000);
+	string s(buf);
+	for (int i = 0; i < BUCKETS; i++) {
+		snprintf(buf, sizeof(buf), "%c%lu", i == 0 ? ' ' : ',', bucket(i));
+		s += buf;
+	}
+	return s;
+}
+
+Timer::Timer(Histogram *hist) : hist(hist), begin(0) {
+}
+
+void Timer::start() {
+	begin = nanos();
+}
+
+long long Timer::stop() {
+	long long ns = nanos() - begin;
+	hist->add(ns);
+	return ns;
+}
+
+}
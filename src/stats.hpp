@@ -0,0 +1,91 @@
+#ifndef STATS_HPP_
+#define STATS_HPP_
+
+#include <string>
+using namespace std;
+
+namespace stats {
+
+/*
+ * The current time of the monotonic clock in nanoseconds.
+ */
+long long nanos();
+
+/*
+ * The current time of the realtime clock in nanoseconds. Unlike nanos() it
+ * is comparable between processes and, with synchronised clocks, hosts.
+ */
+long long wallNanos();
+
+/*
+ * The CPU time the calling thread has used in nanoseconds. Unlike nanos()
+ * it does not advance while the thread waits or is preempted.
+ */
+long long cpuNanos();
+
+/*
+ * A latency histogram with fixed power-of-two buckets from 1 us up to 4 s.
+ * One thread records into it while any other thread may read it; readings
+ * taken while it is being recorded into may be off by the samples in flight.
+ */
+class Histogram {
+public:
+	static const int BUCKETS = 24;
+
+	Histogram();
+
+	/*
+	 * Records one sample.
+	 */
+	void add(long long ns);
+
+	unsigned long count() const;
+	long long total() const;
+	long long max() const;
+
+	/*
+	 * The number of samples in a bucket and the exclusive upper bound of
+	 * its latencies in nanoseconds. The last bucket is unbounded.
+	 */
+	unsigned long bucket(int i) const;
+	static long long upperBound(int i);
+
+	/*
+	 * An upper bound of the p-th percentile (0 < p <= 100), or 0 when empty.
+	 */
+	long long percentile(double p) const;
+
+	/*
+	 * Formats the histogram as "count mean p50 p90 p99 max" in microseconds
+	 * followed by the comma-separated bucket counts.
+	 */
+	string summary() const;
+
+private:
+	unsigned long counts[BUCKETS];
+	unsigned long samples;
+	long long sum;
+	long long longest;
+};
+
+/*
+ * Measures the time between start() and stop() into a histogram.
+ */
+class Timer {
+public:
+	Timer(Histogram *hist);
+
+	void start();
+
+	/*
+	 * Records the time since start() and returns it in nanoseconds.
+	 */
+	long long stop();
+
+private:
+	Histogram *hist;
+	long long begin;
+};
+
+}
+#endif /* STATS_HPP_ */
@@ -0,0 +1,178 @@
+#include <math.h>
+#include "opencv2/imgproc/imgproc.hpp"
+#include "synth.hpp"
+
+using namespace std;
+
+namespace synth {
+
+static const int SHIFT = 4;  // fractional bits of the drawn circles
+static const float ONE = 1 << SHIFT;
+
+// how far a robot may leave the frame, relative to its radius
+static const float OVERHANG = 0.6f;
+
+Options::Options()
+	: width(1600), height(1200), robots(10), minRadius(60), maxRadius(80), fps(20), speed(200),
+	  noise(8), blur(1.5), lighting(0.3), seed(1) {
+}
+
+Arena::Arena(const Options &opts) : opts(opts), rng(opts.seed), count(0) {
+	if (this->opts.fps <= 0)
+		this->opts.fps = 20;
+	if (this->opts.maxRadius < this->opts.minRadius)
+		this->opts.maxRadius = this->opts.minRadius;
+
+	// a mid grey floor with faint, large blotches
+	Mat coarse(opts.height / 32 + 2, opts.width / 32 + 2, CV_8U);
+	rng.fill(coarse, RNG::UNIFORM, 90, 120);
+	Mat floor;
+	resize(coarse, floor, Size(opts.width, opts.height), 0, 0, INTER_CUBIC);
+	cvtColor(floor, ground, CV_GRAY2BGR);
+	gain.resize(opts.width);
+	place();
+}
+
+/*
+ * Scatters the robots over the frame without overlaps where possible, each
+ * heading in a random direction.
+ */
+void Arena::place() {
+	bots.clear();
+	for (int i = 0; i < opts.robots; i++) {
+		Robot b;
+		b.id = i;
+		b.radius = rng.uniform((float)opts.minRadius, (float)opts.maxRadius);
+		for (int attempt = 0; attempt < 1000; attempt++) {
+			b.pos.x = rng.uniform(b.radius, MAX(opts.width - b.radius, b.radius + 1));
+			b.pos.y = rng.uniform(b.radius, MAX(opts.height - b.radius, b.radius + 1));
+			bool free = true;
+			for (size_t j = 0; j < bots.size() && free; j++) {
+				float dx = bots[j].pos.x - b.pos.x;
+				float dy = bots[j].pos.y - b.pos.y;
+				float gap = bots[j].radius + b.radius;
+				free = dx*dx + dy*dy >= gap*gap;
+			}
+			if (free)
+				break;
+		}
+		float heading = rng.uniform(0.f, (float)(2 * CV_PI));
+		float step = opts.speed / opts.fps * rng.uniform(0.5f, 1.f);
+		b.vel.x = step * cos(heading);
+		b.vel.y = step * sin(heading);
+		bots.push_back(b);
+	}
+}
+
+/*
+ * Moves every robot along a slowly wandering heading. Robots bounce off
+ * each other and off the arena walls, which lie just outside the frame.
+ */
+void Arena::move() {
+	for (size_t i = 0; i < bots.size(); i++) {
+		Robot &b = bots[i];
+		float turn = rng.gaussian(0.1);
+		float vx = b.vel.x * cos(turn) - b.vel.y * sin(turn);
+		float vy = b.vel.x * sin(turn) + b.vel.y * cos(turn);
+		b.vel.x = vx;
+		b.vel.y = vy;
+		b.pos.x += vx;
+		b.pos.y += vy;
+
+		float out = OVERHANG * b.radius;
+		if (b.pos.x < -out || b.pos.x > opts.width - 1 + out) {
+			b.pos.x = MIN(MAX(b.pos.x, -out), opts.width - 1 + out);
+			b.vel.x = -b.vel.x;
+		}
+		if (b.pos.y < -out || b.pos.y > opts.height - 1 + out) {
+			b.pos.y = MIN(MAX(b.pos.y, -out), opts.height - 1 + out);
+			b.vel.y = -b.vel.y;
+		}
+	}
+
+	// equal masses exchange their velocities along the line of contact
+	for (size_t i = 0; i < bots.size(); i++) {
+		for (size_t j = i + 1; j < bots.size(); j++) {
+			Robot &a = bots[i];
+			Robot &b = bots[j];
+			float dx = b.pos.x - a.pos.x;
+			float dy = b.pos.y - a.pos.y;
+			float gap = a.radius + b.radius;
+			float d2 = dx*dx + dy*dy;
+			if (d2 >= gap*gap || d2 < 1e-6f)
+				continue;
+			float d = sqrt(d2);
+			float nx = dx / d;
+			float ny = dy / d;
+			float push = (gap - d) / 2;
+			a.pos.x -= nx * push;
+			a.pos.y -= ny * push;
+			b.pos.x += nx * push;
+			b.pos.y += ny * push;
+			float closing = (a.vel.x - b.vel.x) * nx + (a.vel.y - b.vel.y) * ny;
+			if (closing > 0) {
+				a.vel.x -= closing * nx;
+				a.vel.y -= closing * ny;
+				b.vel.x += closing * nx;
+				b.vel.y += closing * ny;
+			}
+		}
+	}
+}
+
+void Arena::render(Mat &frame) {
+	ground.copyTo(frame);
+	for (size_t i = 0; i < bots.size(); i++) {
+		const Robot &b = bots[i];
+		// drawn with sub-pixel centres so the ground truth is exact
+		Point centre(cvRound(b.pos.x * ONE), cvRound(b.pos.y * ONE));
+		int shade = 190 + (b.id * 37) % 50;
+		circle(frame, centre, cvRound(b.radius * ONE), Scalar(shade, shade, shade), -1, CV_AA, SHIFT);
+		circle(frame, centre, cvRound(b.radius * 0.4f * ONE), Scalar(40, 40, 40), -1, CV_AA, SHIFT);
+	}
+
+	if (opts.blur > 0)
+		GaussianBlur(frame, frame, Size(0, 0), opts.blur);
+
+	// the overall brightness and a left to right falloff drift slowly
+	double t = count / opts.fps;
+	double level = 1 + opts.lighting * 0.5 * sin(2 * CV_PI * t / 10);
+	double slope = opts.lighting * 0.5 * sin(2 * CV_PI * t / 17 + 1);
+	for (int x = 0; x < opts.width; x++)
+		gain[x] = level * (1 + slope * ((double)x / MAX(opts.width - 1, 1) - 0.5));
+	for (int y = 0; y < frame.rows; y++) {
+		uchar *p = frame.ptr<uchar>(y);
+		for (int x = 0; x < frame.cols; x++, p += 3) {
+			p[0] = saturate_cast<uchar>(p[0] * gain[x]);
+			p[1] = saturate_cast<uchar>(p[1] * gain[x]);
+			p[2] = saturate_cast<uchar>(p[2] * gain[x]);
+		}
+	}
+
+	if (opts.noise > 0) {
+		noiseBuf.create(frame.size(), CV_16SC3);
+		rng.fill(noiseBuf, RNG::NORMAL, 0, opts.noise);
+		add(frame, noiseBuf, frame, noArray(), CV_8U);
+	}
+}
+
+void Arena::next(Mat &frame) {
+	if (count > 0)
+		move();
+	render(frame);
+	count++;
+}
+
+const vector<Robot> &Arena::robots() const {
+	return bots;
+}
+
+bool Arena::visible(const Robot &robot) const {
+	return robot.pos.x >= 0 && robot.pos.x < opts.width && robot.pos.y >= 0 && robot.pos.y < opts.height;
+}
+
+int Arena::frames() const {
+	return count;
+}
+
+}
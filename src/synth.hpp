@@ -0,0 +1,88 @@
+#ifndef SYNTH_HPP_
+#define SYNTH_HPP_
+
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+using namespace cv;
+
+namespace synth {
+
+/*
+ * The look and motion of a synthetic arena.
+ */
+struct Options {
+	int width;
+	int height;
+	int robots;
+	int minRadius;    // robot radii are drawn uniformly from this band
+	int maxRadius;
+	double fps;       // frames per second of simulated time
+	double speed;     // top robot speed in pixels per second
+	double noise;     // standard deviation of the pixel noise
+	double blur;      // sigma of the Gaussian blur (0 disables)
+	double lighting;  // relative amplitude of the brightness changes
+	unsigned seed;
+
+	Options();
+};
+
+/*
+ * A robot of the arena. Its centre may lie slightly outside the frame,
+ * leaving the robot partially cut off by the image edge.
+ */
+struct Robot {
+	int id;
+	Point2f pos;
+	Point2f vel;  // pixels per frame
+	float radius;
+};
+
+/*
+ * Renders frames of robots moving around an arena, as a top-down camera
+ * would see them: circular robots on a textured floor under changing
+ * lighting, blurred and noisy. The same options and seed always produce
+ * the same frames, so a recording and a live run of the generator share
+ * one ground truth.
+ */
+class Arena {
+public:
+	Arena(const Options &opts);
+
+	/*
+	 * Advances the robots by one frame and renders it as a color image.
+	 */
+	void next(Mat &frame);
+
+	/*
+	 * The robots as rendered in the last frame.
+	 */
+	const std::vector<Robot> &robots() const;
+
+	/*
+	 * Tests whether a robot's centre lies within the frame, i.e. whether a
+	 * detector can be expected to find it.
+	 */
+	bool visible(const Robot &robot) const;
+
+	/*
+	 * The number of frames rendered so far.
+	 */
+	int frames() const;
+
+private:
+	void place();
+	void move();
+	void render(Mat &frame);
+
+	Options opts;
+	RNG rng;
+	std::vector<Robot> bots;
+	int count;
+	Mat ground;             // the floor texture, without lighting
+	Mat noiseBuf;
+	std::vector<float> gain;  // the lighting of each column
+};
+
+}
+#endif /* SYNTH_HPP_ */
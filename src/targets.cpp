@@ -0,0 +1,121 @@
+#include <algorithm>
+#include "targets.hpp"
+
+using namespace std;
+
+namespace targets {
+
+// weight of the newest measurement in the smoothed velocity
+static const float VELOCITY_GAIN = 0.5f;
+
+Tracker::Tracker(float gate, int maxMissed) : gate(gate), maxMissed(maxMissed), nextId(0) {
+}
+
+const vector<Target> &Tracker::targets() const {
+	return tracked;
+}
+
+void Tracker::update(const vector<Point2f> &points, long long stamp, vector<int> *ids) {
+	// predict every target to the time of this frame
+	predicted.resize(tracked.size());
+	for (size_t t = 0; t < tracked.size(); t++) {
+		float dt = (stamp - tracked[t].stamp) / 1e9f;
+		predicted[t] = Point2f(tracked[t].pos.x + tracked[t].vel.x * dt, tracked[t].pos.y + tracked[t].vel.y * dt);
+	}
+
+	pairs.clear();
+	const float gate2 = gate * gate;
+	for (size_t t = 0; t < tracked.size(); t++) {
+		for (size_t p = 0; p < points.size(); p++) {
+			float dx = points[p].x - predicted[t].x;
+			float dy = points[p].y - predicted[t].y;
+			Pair pair;
+			pair.dist2 = dx*dx + dy*dy;
+			if (pair.dist2 > gate2)
+				continue;
+			pair.target = t;
+			pair.point = p;
+			pairs.push_back(pair);
+		}
+	}
+	sort(pairs.begin(), pairs.end());
+
+	ids->assign(points.size(), -1);
+	assigned.assign(tracked.size(), false);
+	for (size_t i = 0; i < pairs.size(); i++) {
+		const Pair &pair = pairs[i];
+		if (assigned[pair.target] || (*ids)[pair.point] >= 0)
+			continue;
+		assigned[pair.target] = true;
+
+		Target &target = tracked[pair.target];
+		const Point2f &pos = points[pair.point];
+		float dt = (stamp - target.stamp) / 1e9f;
+		if (dt > 0) {
+			target.vel.x += VELOCITY_GAIN * ((pos.x - target.pos.x) / dt - target.vel.x);
+			target.vel.y += VELOCITY_GAIN * ((pos.y - target.pos.y) / dt - target.vel.y);
+		}
+		target.pos = pos;
+		target.stamp = stamp;
+		target.missed = 0;
+		(*ids)[pair.point] = target.id;
+	}
+
+	// age out the targets that were not seen, then start the new ones
+	size_t kept = 0;
+	for (size_t t = 0; t < tracked.size(); t++) {
+		if (!assigned[t] && ++tracked[t].missed > maxMissed)
+			continue;
+		tracked[kept++] = tracked[t];
+	}
+	tracked.resize(kept);
+
+	for (size_t p = 0; p < points.size(); p++) {
+		if ((*ids)[p] >= 0)
+			continue;
+		Target target;
+		target.id = nextId++;
+		target.pos = points[p];
+		target.vel = Point2f(0, 0);
+		target.stamp = stamp;
+		target.missed = 0;
+		tracked.push_back(target);
+		(*ids)[p] = target.id;
+	}
+}
+
+Delta::Delta(float epsilon) : epsilon(epsilon) {
+}
+
+void Delta::reset() {
+	published.clear();
+}
+
+void Delta::diff(const vector<int> &ids, const vector<Point2f> &points, vector<size_t> *changed,
+                 vector<int> *removed) {
+	changed->clear();
+	removed->clear();
+	const float eps2 = epsilon * epsilon;
+
+	current.clear();
+	for (size_t i = 0; i < ids.size(); i++) {
+		current[ids[i]] = points[i];
+		std::map<int, Point2f>::iterator it = published.find(ids[i]);
+		if (it != published.end()) {
+			float dx = points[i].x - it->second.x;
+			float dy = points[i].y - it->second.y;
+			if (dx*dx + dy*dy <= eps2) {
+				// small moves accumulate against the position last published
+				current[ids[i]] = it->second;
+				continue;
+			}
+		}
+		changed->push_back(i);
+	}
+	for (std::map<int, Point2f>::iterator it = published.begin(); it != published.end(); ++it)
+		if (current.find(it->first) == current.end())
+			removed->push_back(it->first);
+	published.swap(current);
+}
+
+}
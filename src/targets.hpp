@@ -0,0 +1,93 @@
+#ifndef TARGETS_HPP_
+#define TARGETS_HPP_
+
+#include <map>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+using namespace cv;
+
+namespace targets {
+
+/*
+ * A robot followed across frames.
+ */
+struct Target {
+	int id;
+	Point2f pos;       // last measured position
+	Point2f vel;       // smoothed velocity in units per second
+	long long stamp;   // capture time of the last measurement in ns
+	int missed;        // frames since the last measurement
+};
+
+/*
+ * Gives the robots detected in consecutive frames stable IDs. Every target's
+ * position is predicted at constant velocity; detections are then assigned
+ * greedily, closest pair first, to the predicted targets within the gate
+ * distance. Unassigned detections start new targets and targets missed for
+ * more than maxMissed frames are dropped.
+ */
+class Tracker {
+public:
+	Tracker(float gate, int maxMissed = 5);
+
+	/*
+	 * Updates the targets with the positions detected in a frame captured at
+	 * stamp (in ns) and stores the ID of each position in ids.
+	 */
+	void update(const vector<Point2f> &points, long long stamp, vector<int> *ids);
+
+	const vector<Target> &targets() const;
+
+private:
+	/*
+	 * A target and a detection within the gate of its prediction.
+	 */
+	struct Pair {
+		float dist2;
+		int target;
+		int point;
+		bool operator<(const Pair &other) const { return dist2 < other.dist2; }
+	};
+
+	float gate;
+	int maxMissed;
+	int nextId;
+	vector<Target> tracked;
+
+	vector<Point2f> predicted;
+	vector<Pair> pairs;
+	vector<bool> assigned;
+};
+
+/*
+ * Remembers the last published position of each target to find the ones
+ * worth publishing again: new targets, targets that moved by more than
+ * epsilon and targets that disappeared.
+ */
+class Delta {
+public:
+	Delta(float epsilon);
+
+	/*
+	 * Compares the current targets with the published ones and records them
+	 * as published. changed receives indices into ids and points, removed
+	 * the IDs that are gone.
+	 */
+	void diff(const vector<int> &ids, const vector<Point2f> &points, vector<size_t> *changed,
+	          vector<int> *removed);
+
+	/*
+	 * Forgets the published targets, e.g. after a diff was lost, so that the
+	 * next diff reports every target as changed.
+	 */
+	void reset();
+
+private:
+	float epsilon;
+	std::map<int, Point2f> published;
+	std::map<int, Point2f> current;
+};
+
+}
+#endif /* TARGETS_HPP_ */
@@ -1,50 +1,258 @@
 #include <unistd.h>
 #include <iostream>
 #include <time.h>
-#include <iostream> 
+#include <iostream>
 #include <sstream>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <hiredis/hiredis.h>
+#include "shm.hpp"
+#include "stats.hpp"
 
 using namespace std;
 
-int main(int argc, char** argv) 
+void help()
+{
+  printf( "Usage: testcli [-mv] [-a <host[:port]>] [-i <secs>] [<camera>]*\n"
+	  "Description:\n"
+	  "  Receives the positions tracker publishes and reports the message rate\n"
+	  "  and the latency percentiles of every camera. By default it subscribes\n"
+	  "  to the redis channels camera<N> (all of them when no camera is given);\n"
+	  "  end-to-end latency runs from frame capture to receipt and transport\n"
+	  "  latency from the tracker sending the message to receipt, both from\n"
+	  "  the timestamps in the messages.\n"
+	  "Options:\n"
+	  "  -a <host[:port]> redis server address (default 127.0.0.1:6379)\n"
+	  "  -i <secs>    interval between reports (default 1); reports are printed\n"
+	  "               as messages arrive, so an idle tracker prints nothing\n"
+	  "  -m           read the shared memory rings /tracker-camera<N> written by\n"
+	  "               tracker -M instead of redis (requires cameras)\n"
+	  "  -v           also print every message\n" );
+}
+
+/*
+ * The messages of one camera since the last report.
+ */
+struct Window
+{
+  unsigned long messages;
+  vector<long long> endToEnd; // capture to receipt, ns
+  vector<long long> transport; // send to receipt, ns
+
+  Window() : messages(0) {}
+};
+
+map<int, Window> windows;
+
+void record(int camera, long long endToEnd, long long transport)
 {
-  // todo - make these command line options
-  const char* redisHost = "127.0.0.1";
-  const int redisPort = 6379;  
-  redisContext *redisc = NULL;
-  
-  redisc = redisConnect( redisHost, redisPort );
-  if( redisc->err )
+  Window &w = windows[camera];
+  w.messages++;
+  w.endToEnd.push_back(endToEnd);
+  w.transport.push_back(transport);
+}
+
+double percentileMs(vector<long long> &samples, double p)
+{
+  if( samples.empty() )
+    return 0;
+  size_t k = (size_t)(p * (samples.size() - 1) + 0.5);
+  nth_element( samples.begin(), samples.begin() + k, samples.end() );
+  return samples[k] / 1e6;
+}
+
+void report(double seconds)
+{
+  for( map<int, Window>::iterator it = windows.begin(); it != windows.end(); ++it )
     {
-      printf( "Redis connection error: %s\n", redisc->errstr);
-      exit(-1);
+      Window &w = it->second;
+      printf( "camera%-3d %6lu msgs %8.1f msg/s  e2e p50 %8.3f p99 %8.3f ms  transport p50 %8.3f p99 %8.3f ms\n",
+	      it->first, w.messages, w.messages / seconds,
+	      percentileMs( w.endToEnd, 0.5 ), percentileMs( w.endToEnd, 0.99 ),
+	      percentileMs( w.transport, 0.5 ), percentileMs( w.transport, 0.99 ) );
+      w.messages = 0;
+      w.endToEnd.clear();
+      w.transport.clear();
     }
-  
-  std::stringstream key;
-  key << "camera" << argv[1];
-  
+  fflush( stdout );
+}
+
+/*
+ * Reads the shared memory rings of the cameras (tracker -M). Reopens a ring
+ * when its tracker restarts.
+ */
+int readShm(const vector<int> &cameras, double interval, bool verbose)
+{
+  vector<shm::Reader *> readers;
+  vector<long long> lastRecord( cameras.size(), stats::nanos() );
+  for( size_t i = 0; i < cameras.size(); i++ )
+    readers.push_back( new shm::Reader() );
+  shm::Record rec;
+  long long lastReport = stats::nanos();
+
   while( 1 )
     {
-      void* reply = redisCommand( redisc, "GET %s", key.str().c_str() );
-      
-      if( reply == NULL )
-	printf( "Redis error on SET: %s\n", redisc->errstr );
-      else
+      bool idle = true;
+      for( size_t i = 0; i < cameras.size(); i++ )
 	{
-	  const redisReply* r = (redisReply*)reply;
-	  
-	  if(  r->type == REDIS_REPLY_STRING )
+	  shm::Reader &reader = *readers[i];
+	  if( reader.empty() || stats::nanos() - lastRecord[i] > 1000000000LL )
+	    {
+	      // a restarted tracker replaces the ring, which only a reopen sees
+	      reader.open( shm::ringName(cameras[i]) );
+	      lastRecord[i] = stats::nanos();
+	    }
+
+	  while( reader.next( &rec ) )
 	    {
-	      if( strlen(r->str) > 1 )
-		cout << r->str << endl;
+	      idle = false;
+	      long long now = stats::nanos();
+	      lastRecord[i] = now;
+	      record( cameras[i], now - rec.captured, now - rec.published );
+	      if( verbose )
+		{
+		  printf( "camera%d seq %llu lost %llu:", cameras[i], rec.seq, reader.lost() );
+		  for( int j = 0; j < rec.count; j++ )
+		    printf( " %d=(%g %g)", rec.positions[j].id, rec.positions[j].x, rec.positions[j].y );
+		  printf( "\n" );
+		}
 	    }
-	  else
-	    cout << "unexpected reply type " << r->type << endl;
 	}
 
-      usleep(3e5);
+      long long now = stats::nanos();
+      if( !windows.empty() && now - lastReport >= interval * 1e9 )
+	{
+	  report( (now - lastReport) / 1e9 );
+	  lastReport = now;
+	}
+      // records are not signalled, so an idle reader backs off a little
+      if( idle )
+	usleep(200);
+    }
+}
+
+/*
+ * Subscribes to the camera channels and blocks until messages arrive.
+ */
+int subscribe(const string &host, int port, const vector<int> &cameras, double interval, bool verbose)
+{
+  redisContext *redisc = redisConnect( host.c_str(), port );
+  if( redisc == NULL || redisc->err )
+    {
+      printf( "Redis connection error: %s\n", redisc ? redisc->errstr : "out of memory" );
+      return -1;
+    }
+
+  if( cameras.empty() )
+    freeReplyObject( redisCommand( redisc, "PSUBSCRIBE camera[0-9]*" ) );
+  for( size_t i = 0; i < cameras.size(); i++ )
+    freeReplyObject( redisCommand( redisc, "SUBSCRIBE camera%d", cameras[i] ) );
+
+  long long lastReport = stats::nanos();
+  void *reply;
+  while( redisGetReply( redisc, &reply ) == REDIS_OK )
+    {
+      long long now = stats::wallNanos();
+      const redisReply *r = (redisReply *)reply;
+      const char *channel = NULL;
+      const char *payload = NULL;
+      if( r->type == REDIS_REPLY_ARRAY && r->elements >= 3 && r->element[0]->type == REDIS_REPLY_STRING )
+	{
+	  if( strcmp( r->element[0]->str, "message" ) == 0 )
+	    {
+	      channel = r->element[1]->str;
+	      payload = r->element[2]->str;
+	    }
+	  else if( strcmp( r->element[0]->str, "pmessage" ) == 0 && r->elements >= 4 )
+	    {
+	      channel = r->element[2]->str;
+	      payload = r->element[3]->str;
+	    }
+	}
+
+      long long captured, sent;
+      int consumed = 0;
+      if( channel != NULL && strncmp( channel, "camera", 6 ) == 0
+	  && sscanf( payload, "%lld %lld %n", &captured, &sent, &consumed ) >= 2 )
+	{
+	  int camera = atoi( channel + 6 );
+	  record( camera, now - captured * 1000, now - sent * 1000 );
+	  if( verbose )
+	    printf( "camera%d: %s\n", camera, payload + consumed );
+	}
+      freeReplyObject( reply );
+
+      long long mono = stats::nanos();
+      if( !windows.empty() && mono - lastReport >= interval * 1e9 )
+	{
+	  report( (mono - lastReport) / 1e9 );
+	  lastReport = mono;
+	}
+    }
+
+  printf( "Redis error: %s\n", redisc->errstr );
+  redisFree( redisc );
+  return -1;
+}
+
+int main(int argc, char** argv)
+{
+  bool useShm = false;
+  bool verbose = false;
+  string redisHost = "127.0.0.1";
+  int redisPort = 6379;
+  double interval = 1;
+
+  int c;
+  while( (c = getopt(argc, argv, "hmva:i:")) != -1 )
+    {
+      switch( c )
+	{
+	case 'm':
+	  useShm = true;
+	  break;
+	case 'v':
+	  verbose = true;
+	  break;
+	case 'a':
+	  {
+	    string addr(optarg);
+	    size_t colon = addr.find(':');
+	    redisHost = addr.substr(0, colon);
+	    if (colon != string::npos)
+	      redisPort = atoi(addr.substr(colon + 1).c_str());
+	  }
+	  break;
+	case 'i':
+	  interval = atof(optarg);
+	  break;
+	case 'h':
+	  help();
+	  return 0;
+	default:
+	  help();
+	  return 1;
+	}
+    }
+
+  vector<int> cameras;
+  for( int i = optind; i < argc; i++ )
+    cameras.push_back( atoi(argv[i]) );
+  if( interval <= 0 )
+    interval = 1;
+
+  if( useShm )
+    {
+      if( cameras.empty() )
+	{
+	  help();
+	  return 1;
+	}
+      return readShm( cameras, interval, verbose );
     }
+  return subscribe( redisHost, redisPort, cameras, interval, verbose );
 }
@@ -1,4 +1,6 @@
+#include <math.h>
 #include "opencv2/imgproc/imgproc.hpp"
+#include "stats.hpp"
 #include "track.hpp"
 
 using namespace std;
@@ -6,6 +8,61 @@ using namespace cv;
 
 namespace track {
 
+Config::Config()
+	: height(0), width(0), blurSize(0), blurSigma(0.0), cannyThresh(0.0),
+	  minRadius(0), maxRadius(0), accThresh(0.0), roiPadding(0), rescanInterval(20),
+	  engine(ENGINE_OPENCV), maxCircles(512), pyramidScale(1), motionScale(0), motionThreshold(20),
+	  motionRate(0.05), blobScale(0), blobThreshold(0), blobMinFill(0.25), blobMaxRobots(4),
+	  groupMinSize(7), groupMergeDist(24) {
+}
+
+bool loadConfig(string filename, Config *conf) {
+	FileStorage fs(filename, FileStorage::READ);
+	if (!fs.isOpened())
+		return false;
+	fs["ImageHeightPx"] >> conf->height;
+	fs["ImageWidthPx"] >> conf->width;
+	fs["BlurSize"] >> conf->blurSize;
+	fs["BlurSigma"] >> conf->blurSigma;
+	fs["CannyThreshold"] >> conf->cannyThresh;
+	fs["MinRadius"] >> conf->minRadius;
+	fs["MaxRadius"] >> conf->maxRadius;
+	fs["AccumulatorThreshold"] >> conf->accThresh;
+	// optional settings keep their defaults when absent
+	if (!fs["RoiPadding"].empty())
+		fs["RoiPadding"] >> conf->roiPadding;
+	if (!fs["RescanInterval"].empty())
+		fs["RescanInterval"] >> conf->rescanInterval;
+	if (!fs["HoughEngine"].empty()) {
+		string engine;
+		fs["HoughEngine"] >> engine;
+		conf->engine = engine == "band" ? ENGINE_BAND : ENGINE_OPENCV;
+	}
+	if (!fs["HoughMaxCircles"].empty())
+		fs["HoughMaxCircles"] >> conf->maxCircles;
+	if (!fs["PyramidScale"].empty())
+		fs["PyramidScale"] >> conf->pyramidScale;
+	if (!fs["MotionScale"].empty())
+		fs["MotionScale"] >> conf->motionScale;
+	if (!fs["MotionThreshold"].empty())
+		fs["MotionThreshold"] >> conf->motionThreshold;
+	if (!fs["MotionRate"].empty())
+		fs["MotionRate"] >> conf->motionRate;
+	if (!fs["BlobScale"].empty())
+		fs["BlobScale"] >> conf->blobScale;
+	if (!fs["BlobThreshold"].empty())
+		fs["BlobThreshold"] >> conf->blobThreshold;
+	if (!fs["BlobMinFill"].empty())
+		fs["BlobMinFill"] >> conf->blobMinFill;
+	if (!fs["BlobMaxRobots"].empty())
+		fs["BlobMaxRobots"] >> conf->blobMaxRobots;
+	if (!fs["GroupMinSize"].empty())
+		fs["GroupMinSize"] >> conf->groupMinSize;
+	if (!fs["GroupMergeDist"].empty())
+		fs["GroupMergeDist"] >> conf->groupMergeDist;
+	return true;
+}
+
 void grayblur(Mat *img, int size, double sigma) {
     cvtColor(*img, *img, CV_RGB2GRAY);
     if (size == 0 || sigma < 0.001)
@@ -16,6 +73,21 @@ void grayblur(Mat *img, int size, double sigma) {
     GaussianBlur(*img, *img, Size(size, size),sigma);
 }
 
+const Mat &blur(const Mat &gray, Mat &blurred, int size, double sigma) {
+	if (size == 0 || sigma < 0.001)
+		return gray;
+
+	if (size % 2 == 0)
+		size++;
+	GaussianBlur(gray, blurred, Size(size, size), sigma);
+	return blurred;
+}
+
+const Mat &grayblur(const Mat &img, Mat &gray, Mat &blurred, int size, double sigma) {
+	cvtColor(img, gray, CV_RGB2GRAY);
+	return blur(gray, blurred, size, sigma);
+}
+
 void canny(Mat *img, double threshold) {
 	Canny(*img, *img, MAX(threshold/2,1), threshold, 3); // taken from hough.cpp:822
 }
@@ -28,6 +100,547 @@ void detectCircles(Mat img, vector<Vec3f> *circles, int blurSize, double blurSig
     		cannyThresh,accThresh, minRadius, maxRadius);
 }
 
+/*
+ * Solves the weighted least squares fit of x^2 + y^2 + D x + E y + F = 0
+ * (the Kasa circle fit) from its accumulated normal equations.
+ */
+static bool solveCircle(const double m[3][3], const double b[3], double *ox, double *oy, double *r) {
+	double det = m[0][0]*(m[1][1]*m[2][2] - m[1][2]*m[2][1])
+	           - m[0][1]*(m[1][0]*m[2][2] - m[1][2]*m[2][0])
+	           + m[0][2]*(m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+	if (fabs(det) < 1e-12)
+		return false;
+	double sol[3];
+	for (int k = 0; k < 3; k++) {
+		double c[3][3];
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				c[i][j] = j == k ? b[i] : m[i][j];
+		sol[k] = (c[0][0]*(c[1][1]*c[2][2] - c[1][2]*c[2][1])
+		        - c[0][1]*(c[1][0]*c[2][2] - c[1][2]*c[2][0])
+		        + c[0][2]*(c[1][0]*c[2][1] - c[1][1]*c[2][0])) / det;
+	}
+	*ox = -sol[0] / 2;
+	*oy = -sol[1] / 2;
+	double r2 = (*ox)*(*ox) + (*oy)*(*oy) - sol[2];
+	if (r2 <= 0)
+		return false;
+	*r = sqrt(r2);
+	return true;
+}
+
+/*
+ * The patch around a circle that refinement reads. Returns false if too
+ * little of it lies within the image.
+ */
+static bool refineBox(const Mat &img, const Vec3f &circle, float band, Rect *box) {
+	int reach = cvCeil(circle[2] + band) + 2;
+	*box = Rect(cvFloor(circle[0]) - reach, cvFloor(circle[1]) - reach, 2*reach + 1, 2*reach + 1);
+	*box &= Rect(0, 0, img.cols, img.rows);
+	return box->width >= 3 && box->height >= 3;
+}
+
+/*
+ * Fits a circle to the gradients gx, gy of the patch at origin, starting
+ * from the given circle.
+ */
+static bool fitCircle(const Mat &gx, const Mat &gy, Point origin, double minGrad, float band,
+                      Vec3f *circle) {
+	double cx = (*circle)[0];
+	double cy = (*circle)[1];
+	double r = (*circle)[2];
+
+	for (int iter = 0; iter < 3; iter++) {
+		double m[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+		double b[3] = {0, 0, 0};
+		int support = 0;
+		for (int y = 0; y < gx.rows; y++) {
+			const float *dx = gx.ptr<float>(y);
+			const float *dy = gy.ptr<float>(y);
+			double v = y + origin.y - cy;
+			for (int x = 0; x < gx.cols; x++) {
+				double u = x + origin.x - cx;
+				double d = sqrt(u*u + v*v);
+				if (fabs(d - r) > band || d < 1)
+					continue;
+				double g = sqrt(dx[x]*dx[x] + dy[x]*dy[x]);
+				// only strong gradients that point across the outline
+				if (g < minGrad || fabs(dx[x]*u + dy[x]*v) < 0.8 * g * d)
+					continue;
+				double a[3] = { u, v, 1 };
+				double rhs = -(u*u + v*v);
+				for (int i = 0; i < 3; i++) {
+					for (int j = 0; j < 3; j++)
+						m[i][j] += g * a[i] * a[j];
+					b[i] += g * a[i] * rhs;
+				}
+				support++;
+			}
+		}
+
+		double ox, oy, nr;
+		if (support < 8 || !solveCircle(m, b, &ox, &oy, &nr))
+			return false;
+		if (fabs(ox) > band || fabs(oy) > band || fabs(nr - r) > band)
+			return false;
+		cx += ox;
+		cy += oy;
+		r = nr;
+		band = MAX(band / 2, 1.5f);
+	}
+
+	*circle = Vec3f(cx, cy, r);
+	return true;
+}
+
+bool refineCircle(const Mat &img, Vec3f *circle, const Config &conf, float band) {
+	Rect box;
+	if (!refineBox(img, *circle, band, &box))
+		return false;
+
+	Mat gray, blurred, gx, gy;
+	const Mat &patch = grayblur(img(box), gray, blurred, conf.blurSize, conf.blurSigma);
+	Sobel(patch, gx, CV_32F, 1, 0, 3);
+	Sobel(patch, gy, CV_32F, 0, 1, 3);
+	return fitCircle(gx, gy, box.tl(), MAX(conf.cannyThresh / 2, 1), band, circle);
+}
+
+/*
+ * Returns an image of the given size and type backed by buf, growing buf
+ * first if it is too small. Unlike a ROI of buf the image is continuous and
+ * has no surrounding pixels for filters to read past its border.
+ */
+static Mat reuse(Mat &buf, Size size, int type) {
+	size_t bytes = (size_t)size.area() * CV_ELEM_SIZE(type);
+	if (buf.total() * buf.elemSize() < bytes)
+		buf.create(1, (int)bytes, CV_8U);
+	return Mat(size, type, buf.data);
+}
+
+Timings::Timings() : motion(0), blobs(0), convert(0), blur(0), hough(0) {
+}
+
+Detector::Detector() : unchanged(false), edgesValid(false), grouper(1, 1), sinceRescan(0) {
+}
+
+Detector::Detector(const Config &conf)
+	: unchanged(false), edgesValid(false), grouper(conf.groupMinSize, conf.groupMergeDist), sinceRescan(0) {
+	configure(conf);
+}
+
+void Detector::configure(const Config &conf) {
+	this->conf = conf;
+
+	// votes and ring support shrink with the circumference
+	const double f = 1.0 / MAX(conf.pyramidScale, 1);
+	coarse = conf;
+	coarse.pyramidScale = 1;
+	coarse.minRadius = MAX(cvFloor(conf.minRadius * f), 1);
+	coarse.maxRadius = cvCeil(conf.maxRadius * f);
+	coarse.accThresh = conf.accThresh * f;
+	coarse.blurSize = cvRound(conf.blurSize * f);
+	coarse.blurSigma = conf.blurSigma * f;
+
+	motion.configure(conf.motionScale, conf.motionThreshold, conf.motionRate);
+	grouper = CircleGrouper(conf.groupMinSize, conf.groupMergeDist);
+	blobs.configure(conf.blobScale, conf.blobThreshold, conf.blobMinFill, conf.blobMaxRobots,
+	                conf.minRadius, conf.maxRadius);
+	reset();
+}
+
+const Config &Detector::config() const {
+	return conf;
+}
+
+void Detector::reset() {
+	windows.clear();
+	sinceRescan = 0;
+	motion.reset();
+}
+
+bool Detector::idle() const {
+	return unchanged;
+}
+
+const Timings &Detector::timings() const {
+	return times;
+}
+
+/*
+ * Converts and blurs an image like grayblur, timing both steps.
+ */
+const Mat &Detector::preprocess(const Mat &img, Mat &gray, Mat &blurred, const Config &conf) {
+	long long t0 = stats::nanos();
+	cvtColor(img, gray, CV_RGB2GRAY);
+	long long t1 = stats::nanos();
+	const Mat &result = blur(gray, blurred, conf.blurSize, conf.blurSigma);
+	times.convert += t1 - t0;
+	times.blur += stats::nanos() - t1;
+	return result;
+}
+
+const vector<int> &Detector::votes() const {
+	return circleVotes;
+}
+
+const Mat &Detector::blurred() const {
+	return last;
+}
+
+const Mat &Detector::edges() {
+	if (!edgesValid) {
+		const Config &c = conf.pyramidScale > 1 ? coarse : conf;
+		edgeMap = reuse(edgeBuf, last.size(), CV_8U);
+		Canny(last, edgeMap, MAX(c.cannyThresh/2, 1), c.cannyThresh, 3);
+		edgesValid = true;
+	}
+	return edgeMap;
+}
+
+void Detector::houghCircles(const Mat &gray, const Config &c, bool overlapping, vector<Vec3f> *circles,
+                            vector<int> *votes) {
+	double minDist = overlapping? 1 : c.minRadius*2;
+	if (c.engine == ENGINE_BAND) {
+		hough.detect(gray, circles, minDist, c.cannyThresh, c.accThresh, c.minRadius, c.maxRadius,
+		             c.maxCircles, votes);
+	} else {
+		// HoughCircles does not report its votes
+		HoughCircles(gray, *circles, CV_HOUGH_GRADIENT, 1, minDist, c.cannyThresh, c.accThresh,
+		             c.minRadius, c.maxRadius);
+		votes->assign(circles->size(), 1);
+	}
+}
+
+void Detector::refine(const Mat &img, Vec3f *circle) {
+	const float band = conf.pyramidScale + 1;
+	Rect box;
+	if (!refineBox(img, *circle, band, &box))
+		return;
+
+	Mat gray = reuse(grayBuf, box.size(), CV_8U);
+	Mat blurred = reuse(blurBuf, box.size(), CV_8U);
+	const Mat &patch = grayblur(img(box), gray, blurred, conf.blurSize, conf.blurSigma);
+	Mat gx = reuse(gxBuf, box.size(), CV_32F);
+	Mat gy = reuse(gyBuf, box.size(), CV_32F);
+	Sobel(patch, gx, CV_32F, 1, 0, 3);
+	Sobel(patch, gy, CV_32F, 0, 1, 3);
+	fitCircle(gx, gy, box.tl(), MAX(conf.cannyThresh / 2, 1), band, circle);
+}
+
+/*
+ * Detects the circles within a region of the image in image coordinates.
+ */
+void Detector::scan(const Mat &img, Rect region, bool overlapping, vector<Vec3f> *circles,
+                    vector<int> *votes) {
+	if (region.area() == 0) {
+		circles->clear();
+		votes->clear();
+		return;
+	}
+	if (conf.pyramidScale <= 1) {
+		Mat gray = reuse(grayBuf, region.size(), CV_8U);
+		Mat blurred = reuse(blurBuf, region.size(), CV_8U);
+		last = preprocess(img(region), gray, blurred, conf);
+		long long start = stats::nanos();
+		houghCircles(last, conf, overlapping, circles, votes);
+		times.hough += stats::nanos() - start;
+		for (size_t i = 0; i < circles->size(); i++) {
+			(*circles)[i][0] += region.x;
+			(*circles)[i][1] += region.y;
+		}
+		return;
+	}
+
+	// detect on a 1/pyramidScale copy of the region
+	const int s = conf.pyramidScale;
+	Size area(MAX(cvRound(region.width / (double)s), 1), MAX(cvRound(region.height / (double)s), 1));
+	long long start = stats::nanos();
+	Mat small = reuse(smallBuf, area, img.type());
+	resize(img(region), small, area, 0, 0, INTER_AREA);
+	times.convert += stats::nanos() - start;
+	Mat gray = reuse(smallGrayBuf, area, CV_8U);
+	Mat blurred = reuse(smallBlurBuf, area, CV_8U);
+	last = preprocess(small, gray, blurred, coarse);
+	start = stats::nanos();
+	houghCircles(last, coarse, overlapping, circles, votes);
+
+	// then refine each circle at full resolution; circles found at the same
+	// coarse position share one refinement
+	const float fx = region.width / (float)area.width;
+	const float fy = region.height / (float)area.height;
+	done.clear();
+	refined.clear();
+	for (size_t i = 0; i < circles->size(); i++) {
+		Vec3f c = (*circles)[i];
+		size_t j = 0;
+		for (; j < done.size(); j++)
+			if (fabs(done[j][0] - c[0]) <= 1 && fabs(done[j][1] - c[1]) <= 1 && fabs(done[j][2] - c[2]) <= 1)
+				break;
+		if (j < done.size()) {
+			(*circles)[i] = refined[j];
+			continue;
+		}
+
+		Vec3f fine(region.x + (c[0] + 0.5f) * fx - 0.5f, region.y + (c[1] + 0.5f) * fy - 0.5f, c[2] * s);
+		refine(img, &fine);
+		done.push_back(c);
+		refined.push_back(fine);
+		(*circles)[i] = fine;
+	}
+	times.hough += stats::nanos() - start;
+}
+
+/*
+ * Merges overlapping rectangles until none overlap, so no pixel is searched
+ * twice.
+ */
+static void merge(vector<Rect> *rects) {
+	vector<Rect> &r = *rects;
+	for (bool merged = true; merged;) {
+		merged = false;
+		for (size_t i = 0; i < r.size() && !merged; i++) {
+			for (size_t j = i + 1; j < r.size(); j++) {
+				if ((r[i] & r[j]).area() > 0) {
+					r[i] |= r[j];
+					r.erase(r.begin() + j);
+					merged = true;
+					break;
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Searches regions that do not overlap into circles.
+ */
+void Detector::scanRegions(const Mat &img, const vector<Rect> &rects, bool overlapping) {
+	Rect frame(0, 0, img.cols, img.rows);
+	circles.clear();
+	circleVotes.clear();
+	for (size_t i = 0; i < rects.size(); i++) {
+		scan(img, rects[i] & frame, overlapping, &found, &foundVotes);
+		circles.insert(circles.end(), found.begin(), found.end());
+		circleVotes.insert(circleVotes.end(), foundVotes.begin(), foundVotes.end());
+	}
+}
+
+/*
+ * Searches the whole frame or, with blobScale set, only the patches around
+ * the blobs that could be robots.
+ */
+void Detector::scanFrame(const Mat &img, bool overlapping) {
+	if (conf.blobScale <= 0) {
+		scan(img, Rect(0, 0, img.cols, img.rows), overlapping, &circles, &circleVotes);
+		return;
+	}
+
+	long long start = stats::nanos();
+	blobs.find(img, &patches);
+	// the threshold may shave off a marker's blurred rim
+	const int pad = conf.maxRadius / 2 + conf.blobScale;
+	for (size_t i = 0; i < patches.size(); i++) {
+		Rect &r = patches[i];
+		r = Rect(r.x - pad, r.y - pad, r.width + 2*pad, r.height + 2*pad);
+	}
+	merge(&patches);
+	times.blobs = stats::nanos() - start;
+	scanRegions(img, patches, overlapping);
+}
+
+const vector<Vec3f> &Detector::detect(const Mat &img, bool overlapping, bool roiOnly) {
+	times = Timings();
+	unchanged = false;
+	if (conf.motionScale > 0) {
+		detectMoving(img, overlapping);
+		return circles;
+	}
+
+	bool rescan = conf.roiPadding <= 0 || windows.empty()
+	              || (!roiOnly && conf.rescanInterval > 0 && sinceRescan >= conf.rescanInterval);
+
+	Rect frame(0, 0, img.cols, img.rows);
+	if (!rescan) {
+		circles.clear();
+		circleVotes.clear();
+		for (size_t i = 0; i < windows.size(); i++) {
+			scan(img, windows[i] & frame, overlapping, &found, &foundVotes);
+			if (found.empty()) {
+				if (roiOnly)
+					continue;   // forgotten until the next rescan
+				rescan = true;  // the target left its window
+				break;
+			}
+			circles.insert(circles.end(), found.begin(), found.end());
+			circleVotes.insert(circleVotes.end(), foundVotes.begin(), foundVotes.end());
+		}
+		sinceRescan++;
+	}
+
+	if (rescan) {
+		scanFrame(img, overlapping);
+		sinceRescan = 0;
+	}
+
+	edgesValid = false;
+	updateWindows(overlapping);
+	return circles;
+}
+
+/*
+ * Searches the changed areas, grown so that they hold any circle whose
+ * outline moved, and the windows of the last targets, which may have
+ * changed too little to show up. The first frame after a reset has no
+ * background to compare to and is searched in full.
+ */
+void Detector::detectMoving(const Mat &img, bool overlapping) {
+	long long start = stats::nanos();
+	bool known = motion.update(img, &regions);
+	times.motion = stats::nanos() - start;
+
+	if (!known) {
+		scanFrame(img, overlapping);
+	} else {
+		if (regions.empty()) {
+			unchanged = true;
+			return;
+		}
+		const int pad = conf.maxRadius + MAX(conf.roiPadding, 0);
+		for (size_t i = 0; i < regions.size(); i++) {
+			Rect &r = regions[i];
+			r = Rect(r.x - pad, r.y - pad, r.width + 2*pad, r.height + 2*pad);
+		}
+		regions.insert(regions.end(), windows.begin(), windows.end());
+		merge(&regions);
+		scanRegions(img, regions, overlapping);
+	}
+
+	edgesValid = false;
+	updateWindows(overlapping);
+}
+
+/*
+ * The next frame is searched around every target found in this one; windows
+ * that overlap are merged so no pixel is searched twice. Overlapping circles
+ * are grouped into targets first, so a one-frame false positive gets no
+ * window that would come back empty and force a rescan. Without overlapping
+ * circles each circle already stands for a target.
+ */
+void Detector::updateWindows(bool overlapping) {
+	windows.clear();
+	if (conf.roiPadding <= 0 && conf.motionScale <= 0)
+		return;
+	const vector<Vec3f> *seeds = &circles;
+	if (overlapping) {
+		grouper.group(circles, circleVotes, &targets);
+		seeds = &targets;
+	}
+	for (size_t i = 0; i < seeds->size(); i++) {
+		const Vec3f &c = (*seeds)[i];
+		int reach = cvCeil(c[2]) + MAX(conf.roiPadding, 0);
+		Rect w(cvFloor(c[0]) - reach, cvFloor(c[1]) - reach, 2*reach + 1, 2*reach + 1);
+		size_t j = 0;
+		for (; j < windows.size(); j++) {
+			if ((windows[j] & w).area() > 0) {
+				windows[j] |= w;
+				break;
+			}
+		}
+		if (j == windows.size())
+			windows.push_back(w);
+	}
+	merge(&windows);
+}
+
+CircleGrouper::CircleGrouper(int minSize, double mergeDist) : minSize(minSize), mergeDist(mergeDist) {
+}
+
+int CircleGrouper::find(int i) {
+	while (parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+void CircleGrouper::group(const vector<Vec3f> &circles, const vector<int> &votes, vector<Vec3f> *groups,
+                          vector<int> *sizes) {
+	groups->clear();
+	if (sizes != NULL)
+		sizes->clear();
+	const int n = circles.size();
+	if (n == 0)
+		return;
+
+	// bucket the centres into a grid of mergeDist cells over their bounding box
+	const float cell = MAX(mergeDist, 1.0);
+	float minX = circles[0][0], minY = circles[0][1], maxX = minX, maxY = minY;
+	for (int i = 1; i < n; i++) {
+		minX = MIN(minX, circles[i][0]);
+		minY = MIN(minY, circles[i][1]);
+		maxX = MAX(maxX, circles[i][0]);
+		maxY = MAX(maxY, circles[i][1]);
+	}
+	const int cols = (int)((maxX - minX) / cell) + 1;
+	const int rows = (int)((maxY - minY) / cell) + 1;
+	heads.assign(cols * rows, -1);
+	next.resize(n);
+	cellOf.resize(n);
+	for (int i = 0; i < n; i++) {
+		int c = (int)((circles[i][1] - minY) / cell) * cols + (int)((circles[i][0] - minX) / cell);
+		cellOf[i] = c;
+		next[i] = heads[c];
+		heads[c] = i;
+	}
+
+	// join every pair of centres closer than mergeDist; only the neighbouring
+	// cells can hold them
+	parent.resize(n);
+	for (int i = 0; i < n; i++)
+		parent[i] = i;
+	const float dist2 = mergeDist * mergeDist;
+	for (int i = 0; i < n; i++) {
+		int cx = cellOf[i] % cols;
+		int cy = cellOf[i] / cols;
+		for (int y = MAX(cy - 1, 0); y <= MIN(cy + 1, rows - 1); y++) {
+			for (int x = MAX(cx - 1, 0); x <= MIN(cx + 1, cols - 1); x++) {
+				for (int j = heads[y * cols + x]; j >= 0; j = next[j]) {
+					if (j <= i)
+						continue;
+					float dx = circles[j][0] - circles[i][0];
+					float dy = circles[j][1] - circles[i][1];
+					if (dx*dx + dy*dy <= dist2) {
+						int a = find(i), b = find(j);
+						if (a != b)
+							parent[b] = a;
+					}
+				}
+			}
+		}
+	}
+
+	// sum each group into its root, weighted by votes
+	sums.assign(n, Vec4d(0, 0, 0, 0));
+	counts.assign(n, 0);
+	for (int i = 0; i < n; i++) {
+		int root = find(i);
+		double w = i < (int)votes.size() ? MAX(votes[i], 1) : 1;
+		sums[root][0] += w * circles[i][0];
+		sums[root][1] += w * circles[i][1];
+		sums[root][2] += w * circles[i][2];
+		sums[root][3] += w;
+		counts[root]++;
+	}
+	for (int i = 0; i < n; i++) {
+		if (counts[i] == 0 || counts[i] < minSize)
+			continue;
+		const Vec4d &s = sums[i];
+		groups->push_back(Vec3f(s[0] / s[3], s[1] / s[3], s[2] / s[3]));
+		if (sizes != NULL)
+			sizes->push_back(counts[i]);
+	}
+}
+
 bool isOccluded(Vec3f circle, int imgWidth, int imgHeight){
     float x = circle[0];
     float y = circle[1];
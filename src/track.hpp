@@ -3,10 +3,65 @@
 
 
 #include "opencv2/core/core.hpp"
+#include "blobs.hpp"
+#include "hough.hpp"
+#include "motion.hpp"
 using namespace cv;
 
 namespace track {
 
+/*
+ * The circle detectors selectable with the HoughEngine setting.
+ */
+enum Engine {
+	ENGINE_OPENCV,  // "opencv": HoughCircles
+	ENGINE_BAND     // "band": CircleHough
+};
+
+/*
+ * Detection parameters stored in a configuration file produced by trackerconf.
+ */
+struct Config {
+	int height;
+	int width;
+	int blurSize;
+	double blurSigma;
+	double cannyThresh;
+	int minRadius;
+	int maxRadius;
+	double accThresh;
+
+	int roiPadding;      // pixels searched around known targets (0 disables ROI tracking)
+	int rescanInterval;  // frames between full-frame rescans in ROI tracking
+
+	Engine engine;       // circle detector to use
+	int maxCircles;      // strongest centres ranked by the band engine
+
+	int pyramidScale;    // detect on a 1/pyramidScale image, then refine (1 disables)
+
+	int motionScale;         // background model at 1/motionScale of the image (0 disables gating)
+	double motionThreshold;  // grey level difference to the model that counts as a change
+	double motionRate;       // weight of each frame in the background model
+
+	int blobScale;         // find candidate blobs at 1/blobScale before full-frame scans (0 disables)
+	double blobThreshold;  // grey level of the markers (0 picks one per frame)
+	double blobMinFill;    // least part of a MinRadius circle a candidate covers
+	double blobMaxRobots;  // most MaxRadius circles a candidate covers
+
+	int groupMinSize;       // circles needed to confirm a target
+	double groupMergeDist;  // pixels between circle centres of the same target
+
+	Config();
+};
+
+
+/*
+ * Loads the detection parameters from a configuration file produced by trackerconf.
+ * Returns false if the file could not be opened.
+ */
+bool loadConfig(string filename, Config *conf);
+
+
 /*
  * Converts a source image to a blurred greyscale image.
  */
@@ -25,6 +80,178 @@ void detectCircles(Mat img, vector<Vec3f> *circles, int blurSize, double blurSig
 		           int minRadius, int maxRadius, double cannyThresh, double accThresh,
 		           bool overlapping = true);
 
+/*
+ * Blurs a greyscale image into blurred, or returns it as is when blurring is
+ * disabled.
+ */
+const Mat &blur(const Mat &gray, Mat &blurred, int size, double sigma);
+
+/*
+ * Converts a color image to greyscale into gray and blurs it into blurred
+ * without allocating when both already have the image's size. Returns the
+ * image to detect on, which is gray when blurring is disabled.
+ */
+const Mat &grayblur(const Mat &img, Mat &gray, Mat &blurred, int size, double sigma);
+
+/*
+ * Refines the centre and radius of a circle to sub-pixel accuracy by fitting
+ * a circle to the strong, radially oriented gradients within band pixels of
+ * its outline. Returns false and leaves the circle untouched if the fit fails.
+ */
+bool refineCircle(const Mat &img, Vec3f *circle, const Config &conf, float band);
+
+/*
+ * Where a Detector spent its last detect() call, in nanoseconds.
+ */
+struct Timings {
+	long long motion;   // background model update and change mask
+	long long blobs;    // candidate blobs of full-frame scans
+	long long convert;  // greyscale conversion, including the pyramid downscale
+	long long blur;
+	long long hough;    // circle search and sub-pixel refinement
+
+	Timings();
+};
+
+/*
+ * Clusters the many overlapping circles found around each target into one
+ * circle per target. Circles whose centres lie within mergeDist of each
+ * other, directly or through other circles, form a group; groups of fewer
+ * than minSize circles are dropped and every other group is replaced by
+ * the average of its circles weighted by their votes. The centres are
+ * bucketed into a grid of mergeDist cells so only neighbouring cells are
+ * compared.
+ */
+class CircleGrouper {
+public:
+	CircleGrouper(int minSize, double mergeDist);
+
+	/*
+	 * Groups circles with their votes (which may be empty). sizes, when
+	 * given, receives the number of circles in each group.
+	 */
+	void group(const vector<Vec3f> &circles, const vector<int> &votes, vector<Vec3f> *groups,
+	           vector<int> *sizes = NULL);
+
+private:
+	int find(int i);
+
+	int minSize;
+	double mergeDist;
+
+	vector<int> heads;   // first circle of each grid cell or -1
+	vector<int> next;    // next circle in the same cell or -1
+	vector<int> cellOf;
+	vector<int> parent;  // union-find forest of the groups
+	vector<Vec4d> sums;  // weighted x, y, r and total weight of each group
+	vector<int> counts;
+};
+
+/*
+ * A circle detector configured once and reused for every frame. It owns all
+ * of its intermediate images and results, which only grow, so detecting on
+ * frames of an unchanging size does not allocate once warmed up.
+ *
+ * With roiPadding set, only a padded window around each target found in the
+ * previous frame is searched. Targets are the groups of overlapping circles
+ * confirmed as by CircleGrouper, so a stray circle gets no window. The full frame is rescanned every
+ * rescanInterval frames, whenever a target is lost and whenever no targets
+ * are known, so that new objects are still picked up. With pyramidScale set,
+ * circles are found on a downscaled copy and refined at full resolution.
+ *
+ * With motionScale set, only the areas that changed against a background
+ * model and the windows of the targets of the previous frame are searched,
+ * without any rescans. When nothing changed at all, nothing is searched and
+ * the previous result is returned again.
+ *
+ * With blobScale set, scans of the full frame only search the patches
+ * around bright blobs whose size fits one or a few robots.
+ */
+class Detector {
+public:
+	Detector();
+	Detector(const Config &conf);
+
+	/*
+	 * Changes the detection parameters and forgets the known targets.
+	 */
+	void configure(const Config &conf);
+	const Config &config() const;
+
+	/*
+	 * Detects the circles in a color image. The result belongs to the
+	 * detector and stays valid until the next call. With roiOnly, known
+	 * targets are only searched for in their windows: a lost target is
+	 * dropped instead of triggering a rescan and the periodic rescan waits
+	 * for the next call without roiOnly. The full frame is still scanned
+	 * when no targets are known.
+	 */
+	const vector<Vec3f> &detect(const Mat &img, bool overlapping = true, bool roiOnly = false);
+
+	/*
+	 * Tests whether the last detect() searched nothing and returned the
+	 * result of the one before.
+	 */
+	bool idle() const;
+
+	/*
+	 * The accumulator votes of each detected circle, or 1 for every circle
+	 * when the engine does not report them.
+	 */
+	const vector<int> &votes() const;
+
+	/*
+	 * Forgets the known targets so that the next frame is scanned in full.
+	 */
+	void reset();
+
+	/*
+	 * The blurred greyscale image and its Canny edges of the last region
+	 * searched, at the pyramid level when pyramidScale is set.
+	 */
+	const Mat &blurred() const;
+	const Mat &edges();
+
+	const Timings &timings() const;
+
+private:
+	const Mat &preprocess(const Mat &img, Mat &gray, Mat &blurred, const Config &conf);
+	void scan(const Mat &img, Rect region, bool overlapping, vector<Vec3f> *circles, vector<int> *votes);
+	void houghCircles(const Mat &gray, const Config &conf, bool overlapping, vector<Vec3f> *circles,
+	                  vector<int> *votes);
+	void refine(const Mat &img, Vec3f *circle);
+	void scanRegions(const Mat &img, const vector<Rect> &rects, bool overlapping);
+	void scanFrame(const Mat &img, bool overlapping);
+	void detectMoving(const Mat &img, bool overlapping);
+	void updateWindows(bool overlapping);
+
+	Config conf;
+	Config coarse;  // the parameters scaled to the pyramid level
+
+	CircleHough hough;
+	MotionMask motion;
+	vector<Rect> regions;  // the areas motion gating searches
+	BlobFinder blobs;
+	vector<Rect> patches;  // the candidate patches of full-frame scans
+	bool unchanged;
+	// grow-only storage behind the intermediate images
+	Mat grayBuf, blurBuf, edgeBuf;
+	Mat smallBuf, smallGrayBuf, smallBlurBuf;
+	Mat gxBuf, gyBuf;
+	Mat last;     // the image the last search ran on
+	Mat edgeMap;  // its edges, computed on demand
+	bool edgesValid;
+
+	vector<Vec3f> circles, found;
+	vector<int> circleVotes, foundVotes;
+	vector<Vec3f> done, refined;  // coarse circles and their refinements
+	CircleGrouper grouper;  // confirms the targets windows are kept for
+	vector<Vec3f> targets;
+	vector<Rect> windows;
+	int sinceRescan;
+	Timings times;
+};
+
 /*
  * Tests whether a circle is partially occluded.
  */
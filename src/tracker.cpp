@@ -1,60 +1,786 @@
 #include <unistd.h>
+#include <pthread.h>
 #include <iostream>
+#include <fstream>
+#include <stdio.h>
 #include <time.h>
 #include <iostream> // for stringstream
 
-#include <hiredis/hiredis.h>
-
 #include "opencv2/highgui/highgui.hpp"
-#include "opencv2/objdetect/objdetect.hpp"
 #include "calib.hpp"
+#include "fusion.hpp"
+#include "pipeline.hpp"
+#include "publish.hpp"
+#include "sched.hpp"
+#include "shm.hpp"
+#include "source.hpp"
+#include "stats.hpp"
+#include "targets.hpp"
 #include "track.hpp"
 
 using namespace std;
 using namespace cv;
 
 void help() {
-	cout << "Usage: trackconf [option]* -t ..." << endl
+	cout << "Usage: tracker [option]* -t ..." << endl
 	     << "Description:" << endl
-	     << "  Streams the location of circular objects within the video feed." << endl
+	     << "  Streams the location of circular objects within the video feeds." << endl
+	     << "  Several cameras may be tracked by one process by repeating -v (and -c);" << endl
+	     << "  the n-th calibration file is paired with the n-th video input. Inputs may" << endl
+	     << "  be devices or recordings (video file, image directory, image list), or" << endl
+	     << "  synth:<robots>[,<seed>] for a synthetic arena rendered on the fly (see gensynth)." << endl
+	     << "  Devices are camera<N> by their device number, other inputs are numbered on" << endl
+	     << "  from the highest device in the order given." << endl
+	     << "  With -r, every frame is also PUBLISHed to the redis channel camera<N> as" << endl
+	     << "  \"<capture us> <send us> <x0> <y0> ...\" with wall clock timestamps, which" << endl
+	     << "  testcli subscribes to for latency measurements." << endl
 	     << "Params:" << endl
 	     << "  -t <file>    configuration file produced by trackerconf" << endl
 	     << "Options:" << endl
+	     << "  -a <host[:port]> redis server address (default 127.0.0.1:6379)" << endl
+	     << "  -B <cores>   CPU cores the detection of all live cameras may use together," << endl
+	     << "               shared out fairly (default: every core). A camera over its share" << endl
+	     << "               first searches only around known robots, then does so on a coarser" << endl
+	     << "               image, then lowers its frame rate; frames older than two periods" << endl
+	     << "               are dropped. 0 scans every frame in full at the -f rate" << endl
 	     << "  -c <calib>   camera calibration file to convert to world coords" << endl
 	     << "  -d           enable debugging output" << endl
+	     << "  -e <eps>     publish each robot to the redis hash camera<N>:targets, keyed by" << endl
+	     << "               its ID, only when it appears, disappears or moves more than eps;" << endl
+	     << "               the hash is rebuilt in full whenever a redis message was dropped" << endl
 	     << "  -f <fps>     max framerate at which camera is scanned (default 20)" << endl
+	     << "  -g <dist>    max distance a robot moves between frames and keeps its ID" << endl
+	     << "               (default 200)" << endl
+	     << "  -F <hz>      merge the calibrated cameras' detections into the redis key" << endl
+	     << "               robots at this rate (requires -r)" << endl
 	     << "  -h           this help info" << endl
-	     << "  -r           enable redis (127.0.0.1:6379)" << endl
+	     << "  -i <secs>    interval at which stats are written (default 10)" << endl
+	     << "  -k           undistort pixels with the calibration's lens model" << endl
+	     << "  -l           loop recorded inputs" << endl
+	     << "  -m <file>    camera manifest, one \"<input> [calib]\" pair per line" << endl
+	     << "  -M           write each camera's positions to the shared memory ring" << endl
+	     << "               /tracker-camera<N> for readers on this host (see testcli -m)" << endl
+	     << "  -p           replay recorded inputs in real time (default: as fast as possible)" << endl
+	     << "  -R <dist>    world distance within which -F merges detections (default 200)" << endl
+	     << "  -r           enable redis" << endl
+	     << "  -s <file>    periodically write per-stage latency stats to a file" << endl
+	     << "  -S           periodically write per-stage latency stats to the redis" << endl
+	     << "               hash camera<N>:stats (requires -r)" << endl
 	     << "  -u           enable ui" << endl
-	     << "  -v <num>     video input device number (default 0)" << endl
+	     << "  -v <input>   video input device number or recording (default 0)" << endl
 ;
 }
 
-void toWorld(Mat m, vector<Vec3f> pixelCircles) {
-    for (int i = 0; i < pixelCircles.size(); i++) {
-        calib::toWorld(m, pixelCircles[i][0], pixelCircles[i][1], &pixelCircles[i][0], &pixelCircles[i][1]);
+const int RING_SLOTS = 6;
+
+/*
+ * The timed stages of a camera's pipeline. Total runs from the end of
+ * capture to the end of output.
+ */
+enum Stage {
+  STAGE_CAPTURE, STAGE_MOTION, STAGE_BLOBS, STAGE_CONVERT, STAGE_BLUR, STAGE_HOUGH, STAGE_GROUP,
+  STAGE_WORLD, STAGE_TRACK, STAGE_PUBLISH, STAGE_UI, STAGE_TOTAL, NUM_STAGES
+};
+const char *stageNames[NUM_STAGES] = {
+  "capture", "motion", "blobs", "convert", "blur", "hough", "group", "world", "track", "publish", "ui", "total"
+};
+
+/*
+ * The results of processing one frame, kept alongside its ring slot.
+ */
+struct Detections {
+  vector<Vec3f> circles;
+  vector<Vec3f> groups; // one averaged circle per target
+  vector<Point2f> points; // group centres, in world coords when calibrated
+  vector<int> pointIds; // target ID of each point
+  vector<int> ids; // every live target, including those missed in this frame
+  vector<Point2f> targets;
+  long long detectNs;
+  bool shed; // dropped as stale, released without output
+};
+
+/*
+ * A camera tracked by a pipeline of capture, detect and output threads.
+ */
+struct Camera {
+  int index; // position in the camera list
+  int cam;
+  string input;
+  bool hasCalib;
+  string calibfile;
+  calib::Calibration calibration;
+  string name;
+
+  pipeline::FrameRing *ring;
+  vector<Detections> detections; // indexed by ring slot
+  pipeline::SpscQueue<int> *detected; // slots ready for output
+  sem_t outputReady;
+  bool detectDone;
+  bool live;
+
+  stats::Histogram latency[NUM_STAGES]; // each recorded by a single stage
+  unsigned long skipped; // processed frames overtaken before output
+  unsigned long shed; // frames dropped by the scheduler as stale
+  unsigned long idle; // frames motion gating found unchanged
+  int level; // the scheduler's level and period, for the stats
+  long long period;
+
+  pthread_t captureThread, detectThread, outputThread;
+  pthread_mutex_t lock; // guards display and fresh
+  Mat display;
+  bool fresh;
+};
+
+/*
+ * Settings shared read-only by all camera threads.
+ */
+struct Shared {
+  track::Config conf;
+  bool debug;
+  bool ui;
+  int fps;
+  bool useRedis;
+  bool undistort;
+  source::Options sourceOpts;
+  int statsInterval;
+  string statsFile;
+  bool redisStats;
+  int fusionRate;
+  float gate;
+  float epsilon; // publish deltas only when >= 0
+  bool useShm;
+};
+
+Shared shared;
+publish::Publisher *publisher = NULL;
+sched::Budget *budget = NULL; // NULL keeps the fixed rate
+fusion::Fuser *fuser = NULL;
+
+// reduced scheduler levels rescan the full frame this many times less often
+const int SHED_RESCAN = 4;
+
+// detections older than this are left out of the merged robot list
+const long long FUSION_MAX_AGE = 500000000LL;
+
+pthread_mutex_t runningLock = PTHREAD_MUTEX_INITIALIZER;
+int running = 0;
+
+bool readManifest(string filename, vector<string> *inputs, vector<string> *calibs)
+{
+  ifstream in(filename.c_str());
+  if (!in.is_open())
+    return false;
+
+  string line;
+  while (getline(in, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::stringstream sstm(line);
+    string input;
+    string calibfile;
+    if (!(sstm >> input))
+      continue;
+    sstm >> calibfile;
+    inputs->push_back(input);
+    calibs->push_back(calibfile);
+  }
+  return true;
+}
+
+/*
+ * Capture stage: reads frames into the camera's ring as fast as the input
+ * delivers them.
+ */
+void *runCapture(void *arg)
+{
+  Camera *camera = (Camera *)arg;
+  pipeline::FrameRing *ring = camera->ring;
+
+  source::FrameSource *cap = source::openSource(camera->input, shared.sourceOpts);
+
+  if (cap == NULL) // check if we succeeded
+    cout << "Cannot initialize video capturing for " << camera->input << endl;
+
+  stats::Timer wait(&camera->latency[STAGE_CAPTURE]);
+  while (cap != NULL) {
+    int slot = ring->acquire();
+    wait.start();
+    if (!cap->read(ring->frame(slot)))
+      break;
+    wait.stop();
+    ring->stamp(slot) = stats::nanos();
+    ring->publish(slot);
+  }
+  ring->close();
+
+  delete cap;
+  return NULL;
+}
+
+/*
+ * Detect stage: finds and groups the circles of the newest frame.
+ */
+void *runDetect(void *arg)
+{
+  Camera *camera = (Camera *)arg;
+  const track::Config &conf = shared.conf;
+  const bool debug = shared.debug;
+  const bool hasCalib = camera->hasCalib;
+  const calib::Calibration &calibration = camera->calibration;
+  const bool undistort = shared.undistort;
+  pipeline::FrameRing *ring = camera->ring;
+
+  // recordings are paced by their source, only live cameras are throttled
+  long long period = camera->live ? 1000000000LL/shared.fps : 0;
+  const bool adaptive = budget != NULL && period > 0;
+
+  track::Detector detector(conf);
+  // the coarse level searches one pyramid level further down
+  track::Config coarseConf = conf;
+  coarseConf.pyramidScale = MAX(conf.pyramidScale, 1) * 2;
+  track::Detector coarse(coarseConf);
+  sched::Scheduler scheduler(budget, camera->index, adaptive ? shared.fps : 0, conf.roiPadding > 0);
+  sched::Level last = sched::LEVEL_FULL;
+  unsigned long reduced = 0;
+  track::CircleGrouper grouper(conf.groupMinSize, conf.groupMergeDist);
+  stats::Timer group(&camera->latency[STAGE_GROUP]);
+  stats::Timer world(&camera->latency[STAGE_WORLD]);
+  stats::Timer track(&camera->latency[STAGE_TRACK]);
+  targets::Tracker tracker(shared.gate);
+
+  int slot;
+  while ((slot = ring->take()) >= 0) {
+    Detections &d = camera->detections[slot];
+    vector<Vec3f> &circles = d.circles;
+    vector<Vec3f> &groups = d.groups;
+
+    long long start = stats::nanos();
+    d.shed = !scheduler.fresh(ring->stamp(slot), start);
+    if (d.shed)
+      {
+	// processing it would only publish old positions late
+	__atomic_add_fetch(&camera->shed, 1, __ATOMIC_RELAXED);
+	camera->detected->push(slot);
+	sem_post(&camera->outputReady);
+	continue;
+      }
+    long long cpu = stats::cpuNanos();
+
+    	sched::Level level = scheduler.level();
+    	track::Detector &active = level == sched::LEVEL_COARSE ? coarse : detector;
+    	// the windows of a detector that sat idle are out of date
+    	if ((level == sched::LEVEL_COARSE) != (last == sched::LEVEL_COARSE))
+    	  active.reset();
+    	last = level;
+    	// reduced levels still rescan now and then to pick up new robots
+    	bool roiOnly = level != sched::LEVEL_FULL
+    	               && ++reduced % (SHED_RESCAN * MAX(conf.rescanInterval, 1)) != 0;
+    	circles = active.detect(ring->frame(slot), !debug, roiOnly);
+    	if (active.idle())
+    	  __atomic_add_fetch(&camera->idle, 1, __ATOMIC_RELAXED);
+    	const track::Timings &times = active.timings();
+    	if (conf.motionScale > 0)
+    	  camera->latency[STAGE_MOTION].add(times.motion);
+    	if (conf.blobScale > 0)
+    	  camera->latency[STAGE_BLOBS].add(times.blobs);
+    	camera->latency[STAGE_CONVERT].add(times.convert);
+    	camera->latency[STAGE_BLUR].add(times.blur);
+    	camera->latency[STAGE_HOUGH].add(times.hough);
+
+	group.start();
+	// cluster the circles together - the circles around each target are averaged together
+	grouper.group(circles, active.votes(), &groups);
+	group.stop();
+
+	world.start();
+	d.points.resize(groups.size());
+	for (size_t i = 0; i < groups.size(); i++)
+	  d.points[i] = Point2f(groups[i][0], groups[i][1]);
+	if (hasCalib && !d.points.empty())
+	  calibration.toWorld(&d.points[0], &d.points[0], d.points.size(), undistort);
+	world.stop();
+
+	track.start();
+	tracker.update(d.points, ring->stamp(slot), &d.pointIds);
+	const vector<targets::Target> &live = tracker.targets();
+	d.ids.resize(live.size());
+	d.targets.resize(live.size());
+	for (size_t i = 0; i < live.size(); i++)
+	  {
+	    d.ids[i] = live[i].id;
+	    d.targets[i] = live[i].pos;
+	  }
+	track.stop();
+
+	long long diff = stats::nanos() - start;
+	d.detectNs = diff;
+
+	if (adaptive)
+	  {
+	    scheduler.done(stats::cpuNanos() - cpu);
+	    period = scheduler.period();
+	    __atomic_store_n(&camera->level, (int)scheduler.level(), __ATOMIC_RELAXED);
+	    __atomic_store_n(&camera->period, period, __ATOMIC_RELAXED);
+	  }
+
+	camera->detected->push(slot);
+	sem_post(&camera->outputReady);
+
+        if (diff < period)
+        	usleep((period - diff)/1000);
     }
+
+  __atomic_store_n(&camera->detectDone, true, __ATOMIC_RELEASE);
+  sem_post(&camera->outputReady);
+  return NULL;
 }
 
-long millis(timespec ts) 
+/*
+ * Output stage: publishes and draws the newest processed frame. Frames that
+ * were overtaken while waiting are skipped.
+ */
+void *runOutput(void *arg)
 {
-  return ts.tv_sec*1000+ts.tv_nsec/1000000;
+  Camera *camera = (Camera *)arg;
+  const bool debug = shared.debug;
+  const bool ui = shared.ui;
+  const bool useRedis = shared.useRedis;
+  const bool useShm = shared.useShm;
+  const bool hasCalib = camera->hasCalib;
+  const calib::Calibration &calibration = camera->calibration;
+  const bool undistort = shared.undistort;
+  pipeline::FrameRing *ring = camera->ring;
+
+  std::stringstream keystr;
+  keystr << "camera" << camera->cam;
+  const string key = keystr.str();
+
+  vector<Point2f> world;
+  string value;
+  string message;
+  char number[64];
+  const string targetsKey = key + ":targets";
+  targets::Delta delta(shared.epsilon);
+  vector<size_t> changed;
+  vector<int> removed;
+  // the publisher's drop count when the hash was last known to be complete
+  unsigned long seenDrops = useRedis ? publisher->dropped() : 0;
+  if (useRedis && shared.epsilon >= 0)
+    {
+      // the IDs of a previous run are meaningless now
+      publish::Message clear(1);
+      clear[0].push_back("DEL");
+      clear[0].push_back(targetsKey);
+      publisher->send(clear);
+    }
+  shm::Writer positions;
+  shm::Record record;
+  if (useShm && !positions.create(shm::ringName(camera->cam)))
+    printf("Cannot create shared memory ring %s\n", shm::ringName(camera->cam).c_str());
+  stats::Timer publish(&camera->latency[STAGE_PUBLISH]);
+  stats::Timer draw(&camera->latency[STAGE_UI]);
+
+  while (true) {
+    sem_wait(&camera->outputReady);
+
+    int slot = -1, next;
+    while (camera->detected->pop(&next))
+      {
+	if (slot >= 0)
+	  {
+	    ring->release(slot);
+	    if (!camera->detections[slot].shed)
+	      __atomic_add_fetch(&camera->skipped, 1, __ATOMIC_RELAXED);
+	  }
+	slot = next;
+      }
+    if (slot < 0)
+      {
+	if (__atomic_load_n(&camera->detectDone, __ATOMIC_ACQUIRE) && !camera->detected->pop(&slot))
+	  break;
+	if (slot < 0)
+	  continue;
+      }
+    if (camera->detections[slot].shed)
+      {
+	ring->release(slot);
+	continue;
+      }
+
+    Mat &src = ring->frame(slot);
+    const Detections &d = camera->detections[slot];
+    const vector<Vec3f> &circles = d.circles;
+    const vector<Vec3f> &groups = d.groups;
+    long long diff = d.detectNs;
+
+	if (useRedis || useShm)
+	  publish.start();
+
+	if (useShm)
+	  {
+	    // fixed-size records, copied straight into the ring
+	    record.captured = ring->stamp(slot);
+	    record.camera = camera->cam;
+	    record.found = d.points.size();
+	    record.count = min(record.found, shm::MAX_POSITIONS);
+	    for (int i = 0; i < record.count; i++)
+	      {
+		record.positions[i].x = d.points[i].x;
+		record.positions[i].y = d.points[i].y;
+		record.positions[i].id = d.pointIds[i];
+	      }
+	    positions.write(record);
+	  }
+
+	if( useRedis )
+	  {
+	    // push all rectangles of the frame into Redis at once as robot position estimates
+	    // the output is a string of the x and y positions of each rectangle
+	    // separated by spaces ( "(x0 y0) (x1 y1) (y2 y2)"  )
+	    value.clear();
+	    for (size_t i = 0; i < d.points.size(); i++)
+	      {
+		snprintf(number, sizeof(number), "%g %g ", d.points[i].x, d.points[i].y);
+		value += number;
+	      }
+	    publish::Message msg;
+	    if (shared.epsilon < 0)
+	      {
+		publish::Command set;
+		set.push_back("SET");
+		set.push_back(key);
+		set.push_back(value);
+		msg.push_back(set);
+	      }
+	    else
+	      {
+		// a dropped message may have held deltas that no later diff
+		// repeats, so the hash is rebuilt from scratch
+		unsigned long drops = publisher->dropped();
+		if (drops != seenDrops)
+		  {
+		    seenDrops = drops;
+		    delta.reset();
+		    publish::Command del;
+		    del.push_back("DEL");
+		    del.push_back(targetsKey);
+		    msg.push_back(del);
+		  }
+
+		// only the targets that appeared, moved or disappeared, as "x y" by ID
+		delta.diff(d.ids, d.targets, &changed, &removed);
+		if (!changed.empty())
+		  {
+		    publish::Command hmset;
+		    hmset.push_back("HMSET");
+		    hmset.push_back(targetsKey);
+		    for (size_t i = 0; i < changed.size(); i++)
+		      {
+			snprintf(number, sizeof(number), "%d", d.ids[changed[i]]);
+			hmset.push_back(number);
+			snprintf(number, sizeof(number), "%g %g", d.targets[changed[i]].x, d.targets[changed[i]].y);
+			hmset.push_back(number);
+		      }
+		    msg.push_back(hmset);
+		  }
+		if (!removed.empty())
+		  {
+		    publish::Command hdel;
+		    hdel.push_back("HDEL");
+		    hdel.push_back(targetsKey);
+		    for (size_t i = 0; i < removed.size(); i++)
+		      {
+			snprintf(number, sizeof(number), "%d", removed[i]);
+			hdel.push_back(number);
+		      }
+		    msg.push_back(hdel);
+		  }
+	      }
+
+	    // the same positions stamped for subscribers measuring latency; the
+	    // capture stamp is moved from the monotonic to the wall clock
+	    long long wall = stats::wallNanos();
+	    long long captured = wall - (stats::nanos() - ring->stamp(slot));
+	    snprintf(number, sizeof(number), "%lld %lld ", captured / 1000, wall / 1000);
+	    message = number;
+	    message += value;
+	    publish::Command pub;
+	    pub.push_back("PUBLISH");
+	    pub.push_back(key);
+	    pub.push_back(message);
+	    msg.push_back(pub);
+	    publisher->send(msg);
+	    if (fuser != NULL && hasCalib)
+	      fuser->update(camera->index, d.points, ring->stamp(slot));
+	  }
+
+	if (useRedis || useShm)
+	  publish.stop();
+
+    	if (ui) {
+	  draw.start();
+	  if (debug && hasCalib)
+	    calibration.toWorld(circles, &world, undistort);
+
+	  /// Draw the circles detected
+	  for (size_t i = 0; i < circles.size(); i++) {
+	    Point center(cvRound(circles[i][0]), cvRound(circles[i][1]));
+	    int radius = cvRound(circles[i][2]);
+
+	    if (debug){
+	      float x = circles[i][0];
+	      float y = circles[i][1];
+	      if (hasCalib) {
+		x = world[i].x;
+		y = world[i].y;
+	      }
+
+	      int cx = ((center.x+radius+50)/50)*50;
+	      int cy = ((center.y+50)/50)*50;
+	      Point org(cx, cy);
+	      std::stringstream sstm;
+	      sstm << (int)x << "," << (int)y;
+
+	      putText(src, sstm.str(), org, CV_FONT_HERSHEY_PLAIN, 2,
+		      Scalar(255, 0, 255), 2, 8);
+	    }
+	  }
+	  /// Draw the targets detected, boxed by the circle around them
+	  for (size_t i = 0; i < groups.size(); i++)
+	    {
+	      Point center(cvRound(groups[i][0]), cvRound(groups[i][1]));
+	      int radius = cvRound(groups[i][2]);
+	      rectangle( src,
+			 Point( center.x - radius, center.y - radius ),
+			 Point( center.x + radius, center.y + radius ),
+			 Scalar( 255,0,255 ), 3, 8, 0 );
+
+	      // target center
+	      circle( src, center, 5, Scalar(255, 0, 255), -1, 8, 0);
+	    }
+
+    	    std::stringstream pfps;
+    	    pfps << (int)(diff > 0 ? 1000000000LL/diff : 0) << " proc fps";
+
+        	// capture to display latency
+        	diff = stats::nanos() - ring->stamp(slot);
+        	std::stringstream ufps;
+        	ufps << (int)(diff > 0 ? 1000000000LL/diff : 0) << " ui fps";
+
+    	    putText(src, pfps.str(), Point(50, 150), CV_FONT_HERSHEY_PLAIN, 2,
+    	            Scalar(255, 255, 255), 2, 8);
+    	    putText(src, ufps.str(), Point(50, 200), CV_FONT_HERSHEY_PLAIN, 2,
+    	            Scalar(255, 255, 255), 2, 8);
+
+    	    // hand the frame over to the main thread, which owns the windows
+    	    pthread_mutex_lock(&camera->lock);
+    	    src.copyTo(camera->display);
+    	    camera->fresh = true;
+    	    pthread_mutex_unlock(&camera->lock);
+    	    draw.stop();
+    	}
+
+    camera->latency[STAGE_TOTAL].add(stats::nanos() - ring->stamp(slot));
+    ring->release(slot);
+  }
+
+  pthread_mutex_lock(&runningLock);
+  running--;
+  pthread_mutex_unlock(&runningLock);
+  return NULL;
 }
 
-int main(int argc, char** argv) 
+/*
+ * Writes the stats of every camera to the stats file, replacing it at once so
+ * readers never see a partial file, and to the redis hashes.
+ */
+void dumpStats(vector<Camera> &cameras, long long uptime)
+{
+  if (!shared.statsFile.empty())
+    {
+      string tmp = shared.statsFile + ".tmp";
+      ofstream out(tmp.c_str());
+      out << "# uptime " << uptime / 1000000000LL << " s" << endl
+	  << "# <camera> <stage> count mean_us p50_us p90_us p99_us max_us buckets" << endl
+	  << "# bucket i counts latencies below 2^(10+i) ns, the last is unbounded" << endl;
+      for (size_t i = 0; i < cameras.size(); i++)
+	{
+	  Camera &camera = cameras[i];
+	  for (int st = 0; st < NUM_STAGES; st++)
+	    out << camera.name << ' ' << stageNames[st] << ' ' << camera.latency[st].summary() << endl;
+	  long long period = __atomic_load_n(&camera.period, __ATOMIC_RELAXED);
+	  out << camera.name << " stale " << camera.ring->dropped() << endl
+	      << camera.name << " skipped " << __atomic_load_n(&camera.skipped, __ATOMIC_RELAXED) << endl
+	      << camera.name << " shed " << __atomic_load_n(&camera.shed, __ATOMIC_RELAXED) << endl
+	      << camera.name << " idle " << __atomic_load_n(&camera.idle, __ATOMIC_RELAXED) << endl
+	      << camera.name << " level " << sched::levelNames[__atomic_load_n(&camera.level, __ATOMIC_RELAXED)] << endl
+	      << camera.name << " fps " << (period > 0 ? 1e9 / period : 0) << endl;
+	}
+      if (publisher != NULL)
+	out << "redis dropped " << publisher->dropped() << endl;
+      out.close();
+      if (rename(tmp.c_str(), shared.statsFile.c_str()) != 0)
+	cout << "Cannot write stats file: " << shared.statsFile << endl;
+    }
+
+  if (shared.redisStats && publisher != NULL)
+    {
+      std::stringstream num;
+      publish::Message msg;
+      for (size_t i = 0; i < cameras.size(); i++)
+	{
+	  Camera &camera = cameras[i];
+	  publish::Command cmd;
+	  cmd.push_back("HMSET");
+	  num.str("");
+	  num << "camera" << camera.cam << ":stats";
+	  cmd.push_back(num.str());
+	  for (int st = 0; st < NUM_STAGES; st++)
+	    {
+	      cmd.push_back(stageNames[st]);
+	      cmd.push_back(camera.latency[st].summary());
+	    }
+	  cmd.push_back("stale");
+	  num.str("");
+	  num << camera.ring->dropped();
+	  cmd.push_back(num.str());
+	  cmd.push_back("skipped");
+	  num.str("");
+	  num << __atomic_load_n(&camera.skipped, __ATOMIC_RELAXED);
+	  cmd.push_back(num.str());
+	  cmd.push_back("shed");
+	  num.str("");
+	  num << __atomic_load_n(&camera.shed, __ATOMIC_RELAXED);
+	  cmd.push_back(num.str());
+	  cmd.push_back("idle");
+	  num.str("");
+	  num << __atomic_load_n(&camera.idle, __ATOMIC_RELAXED);
+	  cmd.push_back(num.str());
+	  cmd.push_back("level");
+	  cmd.push_back(sched::levelNames[__atomic_load_n(&camera.level, __ATOMIC_RELAXED)]);
+	  cmd.push_back("fps");
+	  num.str("");
+	  long long period = __atomic_load_n(&camera.period, __ATOMIC_RELAXED);
+	  num << (period > 0 ? 1e9 / period : 0);
+	  cmd.push_back(num.str());
+	  cmd.push_back("uptime");
+	  num.str("");
+	  num << uptime / 1000000000LL;
+	  cmd.push_back(num.str());
+	  msg.push_back(cmd);
+	}
+      publisher->send(msg);
+    }
+}
+
+/*
+ * Stats thread: dumps the stats every statsInterval seconds and once more
+ * when all cameras have finished.
+ */
+void *runStats(void *arg)
+{
+  vector<Camera> &cameras = *(vector<Camera> *)arg;
+  const long long interval = shared.statsInterval * 1000000000LL;
+  const long long start = stats::nanos();
+  long long next = start + interval;
+
+  while (true)
+    {
+      pthread_mutex_lock(&runningLock);
+      bool active = running > 0;
+      pthread_mutex_unlock(&runningLock);
+      if (!active)
+	break;
+
+      long long now = stats::nanos();
+      if (now >= next)
+	{
+	  dumpStats(cameras, now - start);
+	  next += interval;
+	}
+      usleep(100000);
+    }
+  dumpStats(cameras, stats::nanos() - start);
+  return NULL;
+}
+
+/*
+ * Fusion thread: publishes the merged robot list at a fixed rate. Robots
+ * seen by several cameras at once are reported once.
+ */
+void *runFusion(void *arg)
+{
+  const long long period = 1000000000LL / shared.fusionRate;
+  vector<Point2f> robots;
+  string value;
+  char number[32];
+  long long next = stats::nanos();
+
+  while (true)
+    {
+      pthread_mutex_lock(&runningLock);
+      bool active = running > 0;
+      pthread_mutex_unlock(&runningLock);
+      if (!active)
+	break;
+
+      long long now = stats::nanos();
+      if (now < next)
+	{
+	  usleep((next - now) / 1000);
+	  continue;
+	}
+      next += period;
+      if (next < now)
+	next = now + period; // fell behind, do not burst
+
+      // same format as the camera keys, plus the age of the oldest frame merged
+      long long oldest = fuser->merge(now, &robots);
+      value.clear();
+      for (size_t i = 0; i < robots.size(); i++)
+	{
+	  snprintf(number, sizeof(number), "%g %g ", robots[i].x, robots[i].y);
+	  value += number;
+	}
+      publish::Message msg(2);
+      msg[0].push_back("SET");
+      msg[0].push_back("robots");
+      msg[0].push_back(value);
+      snprintf(number, sizeof(number), "%lld", oldest > 0 ? (now - oldest) / 1000000 : 0);
+      msg[1].push_back("SET");
+      msg[1].push_back("robots:age");
+      msg[1].push_back(number);
+      publisher->send(msg);
+    }
+  return NULL;
+}
+
+int main(int argc, char** argv)
 {
   bool debug = false;
   bool ui = false;
   int fps = 20;
-  int cam = 0;
+  vector<string> inputs;
   bool hasTrack = false;
   string trackfile;
-  bool hasCalib = false;
-  string calibfile;
+  vector<string> calibfiles;
   bool useRedis = false;
+  bool undistort = false;
+  source::Options sourceOpts;
+  string redisHost = "127.0.0.1";
+  int redisPort = 6379;
+  int statsInterval = 10;
+  string statsFile;
+  bool redisStats = false;
+  int fusionRate = 0;
+  float fusionRadius = 200;
+  float gate = 200;
+  float epsilon = -1;
+  bool useShm = false;
+  double cores = sysconf(_SC_NPROCESSORS_ONLN);
 
   int c;
-  while ((c = getopt(argc, argv, "drhuv:t:c:f:")) != -1) {
+  while ((c = getopt(argc, argv, "drhkluMv:t:c:f:m:a:pi:s:SF:R:e:g:B:")) != -1) {
     switch (c){
     case 'd':
       debug = true;
@@ -65,22 +791,73 @@ int main(int argc, char** argv)
     case 'u':
       ui = true;
       break;
+    case 'k':
+      undistort = true;
+      break;
+    case 'l':
+      sourceOpts.loop = true;
+      break;
+    case 'p':
+      sourceOpts.pacing = source::REALTIME;
+      break;
     case 'r':
       useRedis = true;
       break;
+    case 'M':
+      useShm = true;
+      break;
+    case 'i':
+      statsInterval = atoi(optarg);
+      break;
+    case 's':
+      statsFile = string(optarg);
+      break;
+    case 'S':
+      redisStats = true;
+      break;
+    case 'F':
+      fusionRate = atoi(optarg);
+      break;
+    case 'R':
+      fusionRadius = atof(optarg);
+      break;
+    case 'e':
+      epsilon = atof(optarg);
+      break;
+    case 'g':
+      gate = atof(optarg);
+      break;
+    case 'B':
+      cores = atof(optarg);
+      break;
+    case 'a':
+      {
+	string addr(optarg);
+	size_t colon = addr.find(':');
+	redisHost = addr.substr(0, colon);
+	if (colon != string::npos)
+	  redisPort = atoi(addr.substr(colon + 1).c_str());
+      }
+      break;
     case 'f':
       fps = atoi(optarg);
       break;
     case 'v':
-      cam = atoi(optarg);
+      inputs.push_back(string(optarg));
       break;
     case 't':
       hasTrack = true;
       trackfile = string(optarg);
       break;
     case 'c':
-      hasCalib = true;
-      calibfile = string(optarg);
+      calibfiles.push_back(string(optarg));
+      break;
+    case 'm':
+      if (!readManifest(string(optarg), &inputs, &calibfiles))
+	{
+	  cout << "Cannot read camera manifest: " << optarg << endl;
+	  return -1;
+	}
       break;
     case '?':
       cout << "Invalid arguments." << endl << endl;
@@ -88,207 +865,209 @@ int main(int argc, char** argv)
       return 1;
     }
   }
-  
-  if (!hasTrack) 
+
+  if (!hasTrack)
     {
       cout << "No tracker configuration file specified." << endl;
       help();
       return -1;
     }
-  
-  int height = 0;
-  int width = 0;
-  int blurSize = 0;
-  double blurSigma = 0.0;
-  int minRadius = 0;
-  int maxRadius = 0;
-  double cannyThresh = 0.0;
-  double accThresh = 0.0;
-  
-  FileStorage fs(trackfile, FileStorage::READ);
-  fs ["ImageHeightPx"] >> height;
-  fs ["ImageWidthPx"] >> width;
-  fs["BlurSize"] >> blurSize;
-  fs["BlurSigma"] >> blurSigma;
-  fs["CannyThreshold"] >> cannyThresh;
-  fs["MinRadius"] >> minRadius;
-  fs["MaxRadius"] >> maxRadius;
-  fs["AccumulatorThreshold"] >> accThresh;
-
-  VideoCapture cap(cam);
-
-  if (!cap.isOpened()) // check if we succeeded
+
+  if (inputs.empty())
+    inputs.push_back("0");
+
+  if (calibfiles.size() > inputs.size())
     {
-      cout << "Cannot initialize video capturing" << endl << endl;
+      cout << "More calibration files than video inputs." << endl;
+      help();
       return -1;
     }
-  cap.set(CV_CAP_PROP_FRAME_WIDTH, width);
-  cap.set(CV_CAP_PROP_FRAME_HEIGHT, height);
-  
-  int period = 1000/fps;
-  
-  Mat src;
-  Mat convert;
-  if (hasCalib) {
-    convert = calib::loadCalib(calibfile);
-  }
+  calibfiles.resize(inputs.size());
 
-  vector<Vec3f> circles;
-  timespec before, after;
-  long mbefore, mafter;
-  
-  string camname;
-  if (ui) {
-    cout << "UI enabled for video" << cam << endl;
-    std::stringstream sstm;
-    sstm << "video" << cam;
-    camname = sstm.str();
-    namedWindow(camname, CV_WINDOW_NORMAL | CV_WINDOW_KEEPRATIO | CV_GUI_EXPANDED);
+  if (redisStats && !useRedis)
+    {
+      cout << "Redis stats require redis (-r)." << endl;
+      help();
+      return -1;
     }
-  
-  // todo - make these command line options
-  const char* redisHost = "127.0.0.1";
-  const int redisPort = 6379;  
-  redisContext *redisc = NULL;
-  
+  if (statsInterval < 1)
+    statsInterval = 1;
+  if (fusionRate > 0 && !useRedis)
+    {
+      cout << "Fusion requires redis (-r)." << endl;
+      help();
+      return -1;
+    }
+
+  shared.debug = debug;
+  shared.ui = ui;
+  shared.fps = fps;
+  shared.useRedis = useRedis;
+  shared.undistort = undistort;
+  shared.sourceOpts = sourceOpts;
+  shared.statsInterval = statsInterval;
+  shared.statsFile = statsFile;
+  shared.redisStats = redisStats;
+  shared.fusionRate = fusionRate;
+  shared.gate = gate;
+  shared.epsilon = epsilon;
+  shared.useShm = useShm;
+  if (!track::loadConfig(trackfile, &shared.conf))
+    {
+      cout << "Cannot read tracker configuration file: " << trackfile << endl;
+      return -1;
+    }
+
   if( useRedis )
     {
-      redisc = redisConnect( redisHost, redisPort );
-      if( redisc->err )
-	{
-	  printf( "Redis connection error: %s\n", redisc->errstr);
-	  exit(-1);
-	}
+      publisher = new publish::Publisher( redisHost, redisPort );
+      if( !publisher->start() )
+	exit(-1);
     }
-  
-  while (cap.read(src)) {
-    clock_gettime(CLOCK_REALTIME, &before);
-     	mbefore = millis(before);
-	
-    	track::detectCircles(src, &circles, blurSize, blurSigma, minRadius, maxRadius, cannyThresh, accThresh, !debug);
-	
-#if 0	
-    	if (circles.size() > 0){
-	  cout << mbefore;
-	  for (int i = 0; i < circles.size(); i++) {
-	    float x = circles[i][0];
-	    float y = circles[i][1];
-	    
-	    if (hasCalib)
-	      calib::toWorld(convert, x, y, &x, &y);
-	    cout << " " << (int)x << " " << (int)y;
-	  }
-	  cout << endl;
-    	}
-#endif
-	
-    	clock_gettime(CLOCK_REALTIME, &after);
-    	mafter = millis(after);
-	
-    	long diff = mafter - mbefore;
-	
-	// convert the circles into bounding rectangles to use OpenCV's clustering routine
-	vector<Rect> rects( circles.size() );
-	for (size_t i = 0; i < circles.size(); i++) 
-	  rects[i] = Rect( circles[i][0], circles[i][1], circles[i][2], circles[i][2] );
-
-	// cluster the rectangles together - similar rectangles are averaged together
-	const int min_group_size = 6;
-	const double rect_relative_size = 0.4;       
-	cv::groupRectangles( rects, min_group_size, rect_relative_size );
-	
-	if( useRedis )
+
+  shared.sourceOpts.width = shared.conf.width;
+  shared.sourceOpts.height = shared.conf.height;
+  shared.sourceOpts.fps = fps;
+
+  // devices keep their number, recordings are numbered on from the highest
+  // device so that no two cameras share a key, channel or shared memory ring
+  vector<int> numbers(inputs.size());
+  int nextNumber = 0;
+  for (size_t i = 0; i < inputs.size(); i++)
+    if (source::isDevice(inputs[i]))
+      nextNumber = max(nextNumber, atoi(inputs[i].c_str()) + 1);
+  for (size_t i = 0; i < inputs.size(); i++)
+    {
+      numbers[i] = source::isDevice(inputs[i]) ? atoi(inputs[i].c_str()) : nextNumber++;
+      for (size_t j = 0; j < i; j++)
+	if (numbers[j] == numbers[i])
 	  {
-	    // push each rectangle into Redis as a robot position estimate
-	    // the output is a string of the x and y positions of each rectangle 
-	    // separated by spaces ( "(x0 y0) (x1 y1) (y2 y2)"  )
-	    std::stringstream str;
-	    for (size_t i = 0; i < rects.size(); i++) 
-	      {
-		float x = rects[i].x;
-		float y = rects[i].y;
-		
-		if (hasCalib)
-		  calib::toWorld(convert, x, y, &x, &y);
-		
-		str << x << ' ' << y << ' ';
-		
-		std::stringstream key;
-		key << "camera" << cam;
-		
-		void* reply = redisCommand( redisc, "SET %s %s", 
-					    key.str().c_str(), str.str().c_str() );
-		
-		if( reply == NULL )
-		  printf( "Redis error on SET: %s\n", redisc->errstr );
-	      }
+	    cout << "Camera " << numbers[i] << " is given more than once." << endl;
+	    return -1;
 	  }
+    }
 
-    	if (ui) {
-	  /// Draw the circles detected
-	  for (size_t i = 0; i < circles.size(); i++) {
-	    Point center(cvRound(circles[i][0]), cvRound(circles[i][1]));
-	    int radius = cvRound(circles[i][2]);
-	    // circle center
-	    //circle(src, center, 1, Scalar(0, 255, 0), -1, 8, 0);
-	    // circle outline
-	    //circle(src, center, radius, Scalar(0, 0, 255), 1, 8, 0);
-	    
-	    if (debug){
-	      float x = circles[i][0];
-	      float y = circles[i][1];
-	      if (hasCalib)
-		calib::toWorld(convert, x, y, &x, &y);
-	      
-	      int cx = ((center.x+radius+50)/50)*50;
-	      int cy = ((center.y+50)/50)*50;
-	      Point org(cx, cy);
-	      std::stringstream sstm;
-	      sstm << (int)x << "," << (int)y;
-	      
-	      putText(src, sstm.str(), org, CV_FONT_HERSHEY_PLAIN, 2,
-		      Scalar(255, 0, 255), 2, 8);
-	    }
-	  }
-	  /// Draw the rectangles detected
-	  for (size_t i = 0; i < rects.size(); i++) 
-	    {
-	      rectangle( src, 
-			 Point( cvRound(rects[i].x - rects[i].width),
-				cvRound(rects[i].y - rects[i].width) ),
-			 Point( cvRound(rects[i].x + rects[i].height),
-				cvRound(rects[i].y  + rects[i].height) ),
-			 Scalar( 255,0,255 ), 3, 8, 0 );			 
-	      
-	      // rectangle center
-	      circle( src, 
-		      Point( cvRound(rects[i].x), cvRound(rects[i].y) ),
-		      5,  Scalar(255, 0, 255), -1, 8, 0);
-	    }
-	
-    	    std::stringstream pfps;
-    	    pfps << (int)(1000/diff) << " proc fps";
+  vector<Camera> cameras(inputs.size());
+  for (size_t i = 0; i < cameras.size(); i++)
+    {
+      Camera &camera = cameras[i];
+      camera.index = i;
+      camera.input = inputs[i];
+      camera.cam = numbers[i];
+      camera.hasCalib = !calibfiles[i].empty();
+      camera.calibfile = calibfiles[i];
+      if (camera.hasCalib && !camera.calibration.load(camera.calibfile))
+	{
+	  cout << "Cannot read calibration file: " << camera.calibfile << endl;
+	  return -1;
+	}
+      camera.fresh = false;
+      pthread_mutex_init(&camera.lock, NULL);
 
-        	clock_gettime(CLOCK_REALTIME, &after);
-        	mafter = millis(after);
-        	diff = mafter - mbefore;
-        	std::stringstream ufps;
-        	ufps << (int)(1000/diff) << " ui fps";
+      // a recording replayed as fast as possible must not skip frames
+      camera.live = source::isDevice(camera.input);
+      bool lossless = !camera.live && shared.sourceOpts.pacing == source::FAST;
+      camera.ring = new pipeline::FrameRing(RING_SLOTS, Size(shared.conf.width, shared.conf.height),
+					    CV_8UC3, lossless);
+      camera.detections.resize(RING_SLOTS);
+      camera.detected = new pipeline::SpscQueue<int>(RING_SLOTS);
+      sem_init(&camera.outputReady, 0, 0);
+      camera.detectDone = false;
+      camera.skipped = 0;
+      camera.shed = 0;
+      camera.idle = 0;
+      camera.level = sched::LEVEL_FULL;
+      camera.period = camera.live ? 1000000000LL/fps : 0;
 
-    	    putText(src, pfps.str(), Point(50, 150), CV_FONT_HERSHEY_PLAIN, 2,
-    	            Scalar(255, 255, 255), 2, 8);
-    	    putText(src, ufps.str(), Point(50, 200), CV_FONT_HERSHEY_PLAIN, 2,
-    	            Scalar(255, 255, 255), 2, 8);
+      std::stringstream sstm;
+      sstm << "video" << camera.cam;
+      camera.name = sstm.str();
+      if (ui) {
+	cout << "UI enabled for " << camera.name << endl;
+	namedWindow(camera.name, CV_WINDOW_NORMAL | CV_WINDOW_KEEPRATIO | CV_GUI_EXPANDED);
+      }
+    }
 
-    	    imshow(camname, src);
-    	}
+  if (fusionRate > 0)
+    fuser = new fusion::Fuser(cameras.size(), fusionRadius, FUSION_MAX_AGE);
+  if (cores > 0)
+    budget = new sched::Budget(cores, cameras.size());
 
-        if (diff < period)
-        	if (ui)
-        		waitKey(period - diff);
-        	else
-        		usleep((period - diff)*1000);
-        else if (ui)
-    		waitKey(1);
+  // start every camera at once; each thread opens its own device
+  running = cameras.size();
+  for (size_t i = 0; i < cameras.size(); i++)
+    {
+      pthread_create(&cameras[i].captureThread, NULL, runCapture, &cameras[i]);
+      pthread_create(&cameras[i].detectThread, NULL, runDetect, &cameras[i]);
+      pthread_create(&cameras[i].outputThread, NULL, runOutput, &cameras[i]);
+    }
+  bool withStats = !statsFile.empty() || redisStats;
+  pthread_t statsThread;
+  if (withStats)
+    pthread_create(&statsThread, NULL, runStats, &cameras);
+  pthread_t fusionThread;
+  if (fuser != NULL)
+    pthread_create(&fusionThread, NULL, runFusion, NULL);
+
+  if (ui)
+    {
+      // highgui windows may only be driven from the main thread
+      int period = 1000/fps;
+      Mat show;
+      while (true)
+	{
+	  pthread_mutex_lock(&runningLock);
+	  bool active = running > 0;
+	  pthread_mutex_unlock(&runningLock);
+	  if (!active)
+	    break;
+
+	  for (size_t i = 0; i < cameras.size(); i++)
+	    {
+	      Camera &camera = cameras[i];
+	      bool fresh;
+	      pthread_mutex_lock(&camera.lock);
+	      fresh = camera.fresh;
+	      if (fresh)
+		camera.display.copyTo(show);
+	      camera.fresh = false;
+	      pthread_mutex_unlock(&camera.lock);
+	      if (fresh)
+		imshow(camera.name, show);
+	    }
+	  waitKey(period);
+	}
+    }
+
+  for (size_t i = 0; i < cameras.size(); i++)
+    {
+      Camera &camera = cameras[i];
+      pthread_join(camera.captureThread, NULL);
+      pthread_join(camera.detectThread, NULL);
+      pthread_join(camera.outputThread, NULL);
+      if (camera.ring->dropped() > 0)
+	cout << camera.name << ": " << camera.ring->dropped() << " stale frames skipped" << endl;
+      sem_destroy(&camera.outputReady);
+    }
+  if (withStats)
+    pthread_join(statsThread, NULL);
+  if (fuser != NULL)
+    {
+      pthread_join(fusionThread, NULL);
+      delete fuser;
+    }
+  for (size_t i = 0; i < cameras.size(); i++)
+    {
+      delete cameras[i].detected;
+      delete cameras[i].ring;
+    }
+
+  if( publisher != NULL )
+    {
+      publisher->stop();
+      if( publisher->dropped() > 0 )
+	cout << "Redis messages dropped: " << publisher->dropped() << endl;
+      delete publisher;
     }
+  return 0;
 }
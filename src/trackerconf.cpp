@@ -1,8 +1,15 @@
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <stdio.h>
 #include "opencv2/features2d/features2d.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/highgui/highgui.hpp"
 #include <unistd.h>
+#include "pipeline.hpp"
+#include "source.hpp"
+#include "stats.hpp"
 #include "track.hpp"
 
 using namespace std;
@@ -15,30 +22,153 @@ int cannyThresh = 100;
 int accThresh = 27;
 int minRadius = 60;
 int maxRadius = 80;
+track::Engine engine = track::ENGINE_OPENCV;
+track::Config base;  // the settings the trackbars and the tuner leave alone
 
+bool dirty = false;  // a trackbar moved since the last recompute
 
-void processImage(Mat img){
+/*
+ * The stages of detection in the order they depend on each other, each
+ * followed by the settings that invalidate it.
+ */
+enum Stage {
+	STAGE_GRAY,     // the frame
+	STAGE_BLUR,     // blur size and sigma
+	STAGE_EDGES,    // Canny threshold and engine
+	STAGE_VOTES,    // radius band
+	STAGE_CIRCLES,  // accumulator threshold
+	STAGE_DONE
+};
+
+const char *stageNames[] = { "gray", "blur", "edges", "votes", "circles", "none" };
+
+/*
+ * The intermediate results of detecting circles on the frame being tuned
+ * on. Changing a setting only recomputes the stages downstream of it.
+ * HoughCircles keeps its edges and accumulator to itself, so with the
+ * opencv engine everything after the blur is recomputed together and the
+ * edges are only computed for display.
+ */
+class StageCache {
+public:
+	StageCache() : valid(STAGE_GRAY), edgesValid(false) {
+	}
+
+	/*
+	 * Starts over on a new frame.
+	 */
+	void setFrame(const Mat &img) {
+		frame = img;
+		valid = STAGE_GRAY;
+	}
+
+	/*
+	 * Brings the circles up to date with the settings. Returns the first
+	 * stage that had to be recomputed.
+	 */
+	Stage update(const track::Config &conf) {
+		Stage first = valid;
+		if (conf.blurSize != done.blurSize || conf.blurSigma != done.blurSigma)
+			first = min(first, STAGE_BLUR);
+		if (conf.cannyThresh != done.cannyThresh || conf.engine != done.engine)
+			first = min(first, STAGE_EDGES);
+		if (conf.minRadius != done.minRadius || conf.maxRadius != done.maxRadius)
+			first = min(first, STAGE_VOTES);
+		if (conf.accThresh != done.accThresh)
+			first = min(first, STAGE_CIRCLES);
+		done = conf;
+
+		if (first <= STAGE_GRAY)
+			cvtColor(frame, gray, CV_RGB2GRAY);
+		if (first <= STAGE_BLUR)
+			blurred = track::blur(gray, blurBuf, conf.blurSize, conf.blurSigma);
+		if (first <= STAGE_EDGES)
+			edgesValid = false;
+
+		if (conf.engine == track::ENGINE_BAND) {
+			if (first <= STAGE_EDGES)
+				hough.findEdges(blurred, conf.cannyThresh);
+			if (first <= STAGE_VOTES)
+				hough.accumulate(conf.minRadius, conf.maxRadius);
+			if (first <= STAGE_CIRCLES)
+				hough.findCircles(&circles, 1, conf.accThresh, conf.maxCircles);
+		} else if (first <= STAGE_CIRCLES) {
+			HoughCircles(blurred, circles, CV_HOUGH_GRADIENT, 1, 1, conf.cannyThresh, conf.accThresh,
+			             conf.minRadius, conf.maxRadius);
+		}
+		valid = STAGE_DONE;
+		return first;
+	}
+
+	const vector<Vec3f> &result() const {
+		return circles;
+	}
+
+	const Mat &blurredImage() const {
+		return blurred;
+	}
+
+	const Mat &edgeImage() {
+		if (done.engine == track::ENGINE_BAND)
+			return hough.edgeImage();
+		if (!edgesValid) {
+			Canny(blurred, edges, MAX(done.cannyThresh/2, 1), done.cannyThresh, 3);
+			edgesValid = true;
+		}
+		return edges;
+	}
+
+private:
+	Mat frame;
+	Mat gray, blurBuf, edges;
+	Mat blurred;  // blurBuf, or gray when blurring is disabled
+	track::CircleHough hough;
 	vector<Vec3f> circles;
 
+	track::Config done;  // the settings of the cached stages
+	Stage valid;         // the first stage not computed on the frame yet
+	bool edgesValid;
+};
+
+StageCache cache;
+
+
+/*
+ * The base settings with those of the trackbars.
+ */
+track::Config trackbarConfig(int width, int height) {
+    // the trackbars hold the blur sigma in tenths
+    track::Config conf = base;
+    conf.width = width;
+    conf.height = height;
+    conf.blurSize = blurSize;
+    conf.blurSigma = ((double) blurSigma) / 10.0;
+    conf.cannyThresh = cannyThresh;
+    conf.accThresh = accThresh;
+    conf.minRadius = minRadius;
+    conf.maxRadius = maxRadius;
+    conf.engine = engine;
+    return conf;
+}
+
+void processImage(Mat img){
     double t = (double) getTickCount();
 
-    track::detectCircles(img, &circles, blurSize, blurSigma, minRadius, maxRadius, cannyThresh, accThresh);
+    Stage first = cache.update(trackbarConfig(img.cols, img.rows));
+    const vector<Vec3f> &circles = cache.result();
 
     t = ((double) getTickCount() - t) / getTickFrequency();
 
     Mat draw;
     switch(mode){
     case 0:
-        draw = img;
+        draw = img.clone();
         break;
     case 1:
-    	track::grayblur(&img, blurSize, ((double) blurSigma) / 10.0);
-        cvtColor(img, draw, CV_GRAY2RGB);
+        cvtColor(cache.blurredImage(), draw, CV_GRAY2RGB);
         break;
     case 2:
-    	track::grayblur(&img, blurSize, ((double) blurSigma) / 10.0);
-        track::canny(&img, cannyThresh);
-        cvtColor(img, draw, CV_GRAY2RGB);
+        cvtColor(cache.edgeImage(), draw, CV_GRAY2RGB);
         break;
     }
 
@@ -55,15 +185,22 @@ void processImage(Mat img){
 
     Point org(50, 150);
     std::stringstream sstm;
-    sstm << (int)(1/t) << "fps";
+    if (first == STAGE_DONE)
+        sstm << "cached";
+    else
+        sstm << (int)(t * 1000) << "ms from " << stageNames[first];
 
     putText(draw, sstm.str(), org, FONT_HERSHEY_SIMPLEX, 3,
             Scalar(255, 255, 255), 5, 8);
     imshow("Circles", draw);
 }
 
-void onChange(int, void *img) {
-    processImage(*(Mat*)img);
+/*
+ * Trackbars only mark the settings as changed; the main loop recomputes
+ * once per pass however many events a drag produced.
+ */
+void onChange(int, void *) {
+    dirty = true;
 }
 
 bool hasEnding (string const &fullString, string const &ending)
@@ -75,31 +212,292 @@ bool hasEnding (string const &fullString, string const &ending)
     }
 }
 
+/*
+ * Every setting track::loadConfig reads, so a rewritten file keeps them all.
+ */
+void saveConfig(string outfile, const track::Config &conf) {
+	cout << "Writing settings to " << outfile << endl;
+	FileStorage fs(outfile, FileStorage::WRITE);
+	fs << "ImageHeightPx" << conf.height;
+	fs << "ImageWidthPx" << conf.width;
+	fs << "BlurSize" << conf.blurSize;
+	fs << "BlurSigma" << conf.blurSigma;
+	fs << "CannyThreshold" << conf.cannyThresh;
+	fs << "MinRadius" << conf.minRadius;
+	fs << "MaxRadius" << conf.maxRadius;
+	fs << "AccumulatorThreshold" << conf.accThresh;
+	fs << "RoiPadding" << conf.roiPadding;
+	fs << "RescanInterval" << conf.rescanInterval;
+	fs << "HoughEngine" << (conf.engine == track::ENGINE_BAND ? "band" : "opencv");
+	fs << "HoughMaxCircles" << conf.maxCircles;
+	fs << "PyramidScale" << conf.pyramidScale;
+	fs << "MotionScale" << conf.motionScale;
+	fs << "MotionThreshold" << conf.motionThreshold;
+	fs << "MotionRate" << conf.motionRate;
+	fs << "BlobScale" << conf.blobScale;
+	fs << "BlobThreshold" << conf.blobThreshold;
+	fs << "BlobMinFill" << conf.blobMinFill;
+	fs << "BlobMaxRobots" << conf.blobMaxRobots;
+	fs << "GroupMinSize" << conf.groupMinSize;
+	fs << "GroupMergeDist" << conf.groupMergeDist;
+	fs.release();
+}
+
+void printConfig(const track::Config &conf) {
+	cout << "ImageHeightPx: " << conf.height << endl;
+	cout << "ImageWidthPx: " << conf.width << endl;
+	cout << "BlurSize: " << conf.blurSize << endl;
+	cout << "BlurSigma: " << conf.blurSigma << endl;
+	cout << "CannyThreshold: " << conf.cannyThresh << endl;
+	cout << "MinRadius: " << conf.minRadius << endl;
+	cout << "MaxRadius: " << conf.maxRadius << endl;
+	cout << "AccumulatorThreshold: " << conf.accThresh << endl;
+	cout << "RoiPadding: " << conf.roiPadding << endl;
+	cout << "RescanInterval: " << conf.rescanInterval << endl;
+	cout << "HoughEngine: " << (conf.engine == track::ENGINE_BAND ? "band" : "opencv") << endl;
+	cout << "HoughMaxCircles: " << conf.maxCircles << endl;
+	cout << "PyramidScale: " << conf.pyramidScale << endl;
+	cout << "MotionScale: " << conf.motionScale << endl;
+	cout << "MotionThreshold: " << conf.motionThreshold << endl;
+	cout << "MotionRate: " << conf.motionRate << endl;
+	cout << "BlobScale: " << conf.blobScale << endl;
+	cout << "BlobThreshold: " << conf.blobThreshold << endl;
+	cout << "BlobMinFill: " << conf.blobMinFill << endl;
+	cout << "BlobMaxRobots: " << conf.blobMaxRobots << endl;
+	cout << "GroupMinSize: " << conf.groupMinSize << endl;
+	cout << "GroupMergeDist: " << conf.groupMergeDist << endl;
+}
+
+/*
+ * A recorded frame and the robots expected in it.
+ */
+struct Truth {
+	Mat frame;
+	int count;
+	vector<Point2f> positions;  // empty when only the count is known
+};
+
+/*
+ * A parameter set tried by the tuner and how it did.
+ */
+struct Candidate {
+	track::Config conf;
+	double errors;  // missed plus spurious robots per frame
+	double ms;      // detection time per frame
+	double cost;
+
+	bool operator<(const Candidate &other) const { return cost < other.cost; }
+};
+
+/*
+ * The work shared by the tuner's threads.
+ */
+struct Tuning {
+	vector<Truth> truth;
+	vector<Candidate> candidates;
+	double msPerError;
+	float tolerance;  // pixels between a detection and the robot it matches
+};
+
+/*
+ * Reads "<image> <count> [<x> <y>]*" lines, images relative to the file.
+ */
+bool readTruth(string filename, vector<Truth> *truth) {
+	ifstream in(filename.c_str());
+	if (!in.is_open())
+		return false;
+
+	string dir;
+	size_t slash = filename.rfind('/');
+	if (slash != string::npos)
+		dir = filename.substr(0, slash + 1);
+
+	string line;
+	while (getline(in, line)) {
+		if (line.empty() || line[0] == '#')
+			continue;
+		std::stringstream sstm(line);
+		string image;
+		Truth t;
+		if (!(sstm >> image >> t.count))
+			continue;
+		float x, y;
+		while (sstm >> x >> y)
+			t.positions.push_back(Point2f(x, y));
+		t.frame = imread(dir + image, 1);
+		if (t.frame.empty()) {
+			cout << "Cannot read image: " << dir + image << endl;
+			return false;
+		}
+		truth->push_back(t);
+	}
+	return true;
+}
+
+/*
+ * The missed plus spurious robots of one frame.
+ */
+int countErrors(const Truth &truth, const vector<Vec3f> &robots, float tolerance) {
+	if (truth.positions.empty())
+		return abs((int)robots.size() - truth.count);
+
+	vector<bool> used(robots.size(), false);
+	int matched = 0;
+	for (size_t i = 0; i < truth.positions.size(); i++) {
+		int best = -1;
+		float bestD2 = tolerance * tolerance;
+		for (size_t j = 0; j < robots.size(); j++) {
+			float dx = robots[j][0] - truth.positions[i].x;
+			float dy = robots[j][1] - truth.positions[i].y;
+			if (!used[j] && dx*dx + dy*dy <= bestD2) {
+				bestD2 = dx*dx + dy*dy;
+				best = j;
+			}
+		}
+		if (best >= 0) {
+			used[best] = true;
+			matched++;
+		}
+	}
+	return (truth.positions.size() - matched) + (robots.size() - matched);
+}
+
+void evaluate(int i, void *arg) {
+	Tuning *tuning = (Tuning *)arg;
+	Candidate &candidate = tuning->candidates[i];
+	track::Detector detector(candidate.conf);
+	track::CircleGrouper grouper(candidate.conf.groupMinSize, candidate.conf.groupMergeDist);
+	vector<Vec3f> robots;
+
+	// the first frame warms up the detector's buffers
+	detector.detect(tuning->truth[0].frame);
+
+	long long total = 0;
+	int errors = 0;
+	for (size_t f = 0; f < tuning->truth.size(); f++) {
+		const Truth &truth = tuning->truth[f];
+		long long start = stats::nanos();
+		grouper.group(detector.detect(truth.frame), detector.votes(), &robots);
+		total += stats::nanos() - start;
+		errors += countErrors(truth, robots, tuning->tolerance);
+	}
+	candidate.errors = errors / (double)tuning->truth.size();
+	candidate.ms = total / 1e6 / tuning->truth.size();
+	candidate.cost = candidate.errors + candidate.ms / tuning->msPerError;
+}
+
+/*
+ * Searches a grid of blur, Canny and accumulator thresholds and radius bands
+ * around the configured one for the settings that detect the expected
+ * robots at the lowest cost. All other settings are those of the base
+ * configuration, so candidates are timed as the tracker would run them.
+ */
+int autoTune(string truthfile, double msPerError, bool out, string outfile) {
+	Tuning tuning;
+	tuning.msPerError = msPerError;
+	tuning.tolerance = minRadius / 2.0f;
+	if (!readTruth(truthfile, &tuning.truth)) {
+		cout << "Cannot read ground truth file: " << truthfile << endl;
+		return 1;
+	}
+	if (tuning.truth.empty()) {
+		cout << "No frames in ground truth file: " << truthfile << endl;
+		return 1;
+	}
+
+	const int blurs[][2] = { {0, 0}, {5, 10}, {5, 20}, {9, 10}, {9, 20} };  // size, sigma in tenths
+	const int cannys[] = { 60, 100, 150 };
+	const int accs[] = { 15, 27, 40 };
+	const double minScales[] = { 0.8, 1.0 };
+	const double maxScales[] = { 1.0, 1.2 };
+
+	track::Config base = trackbarConfig(tuning.truth[0].frame.cols, tuning.truth[0].frame.rows);
+	for (size_t b = 0; b < sizeof(blurs) / sizeof(blurs[0]); b++)
+	for (size_t c = 0; c < sizeof(cannys) / sizeof(cannys[0]); c++)
+	for (size_t a = 0; a < sizeof(accs) / sizeof(accs[0]); a++)
+	for (size_t lo = 0; lo < sizeof(minScales) / sizeof(minScales[0]); lo++)
+	for (size_t hi = 0; hi < sizeof(maxScales) / sizeof(maxScales[0]); hi++) {
+		Candidate candidate;
+		candidate.conf = base;
+		candidate.conf.blurSize = blurs[b][0];
+		candidate.conf.blurSigma = blurs[b][1] / 10.0;
+		candidate.conf.cannyThresh = cannys[c];
+		candidate.conf.accThresh = accs[a];
+		candidate.conf.minRadius = cvRound(minRadius * minScales[lo]);
+		candidate.conf.maxRadius = cvRound(maxRadius * maxScales[hi]);
+		tuning.candidates.push_back(candidate);
+	}
+
+	cout << "Trying " << tuning.candidates.size() << " settings on " << tuning.truth.size()
+	     << " frames..." << endl;
+	pipeline::parallelFor(tuning.candidates.size(), evaluate, &tuning);
+	sort(tuning.candidates.begin(), tuning.candidates.end());
+
+	printf("%6s %6s %6s %6s %6s %6s %10s %10s %8s\n", "blur", "sigma", "canny", "acc", "minR", "maxR",
+	       "errors", "ms/frame", "cost");
+	for (size_t i = 0; i < tuning.candidates.size() && i < 5; i++) {
+		const Candidate &cand = tuning.candidates[i];
+		printf("%6d %6.1f %6.0f %6.0f %6d %6d %10.2f %10.2f %8.3f\n", cand.conf.blurSize, cand.conf.blurSigma,
+		       cand.conf.cannyThresh, cand.conf.accThresh, cand.conf.minRadius, cand.conf.maxRadius,
+		       cand.errors, cand.ms, cand.cost);
+	}
+
+	if (out)
+		saveConfig(outfile, tuning.candidates[0].conf);
+	else
+		printConfig(tuning.candidates[0].conf);
+	return 0;
+}
+
 void help() {
 	cout << "Usage: trackconf [option]* " << endl
 	     << "Description:" << endl
 	     << "  Generates a configuration file used by track to detect circular" << endl
 	     << "  objects (e.g., chatterboxes)." << endl
+	     << "  With -a it instead searches for the settings that find the robots of" << endl
+	     << "  recorded frames fastest and most accurately, without a display." << endl
 	     << "Options:" << endl
+	     << "  -a <truth>:  auto-tune against the frames of a ground truth file, one" << endl
+	     << "               \"<image> <robots> [<x> <y>]*\" line per frame with the number" << endl
+	     << "               of robots and optionally their pixel positions" << endl
 	     << "  -d:          enable debugging output" << endl
+	     << "  -e <engine>: circle detector, \"opencv\" or \"band\" (default: from -t," << endl
+	     << "               else opencv);" << endl
+	     << "               with band, settings changes only recompute later stages" << endl
 	     << "  -h           this help info" << endl
+	     << "  -l           loop recorded inputs" << endl
 	     << "  -o <file>:   output the configuration to file (must end in \".yaml\")" << endl
-	     << "  -v <num>:    video input device number (default 0)" << endl
-	     << "  -x <width>:  the pixel width of the input images (default 1600)" << endl
-	     << "  -y <height>: the pixel height of the input images (default 1200)" << endl
+	     << "  -r <min>,<max>: radius band the auto-tuner searches around (default: from" << endl
+	     << "               -t, else 60,80)" << endl
+	     << "  -t <file>:   configuration to start from, e.g. the deployed track.yaml;" << endl
+	     << "               the settings without a trackbar are written back unchanged" << endl
+	     << "  -v <input>:  video input device number or recording (default 0)" << endl
+	     << "  -w <ms>:     detection time per frame the auto-tuner trades for one" << endl
+	     << "               missed or spurious robot per frame (default 10)" << endl
+	     << "  -x <width>:  the pixel width of the input images (default: from -t, else 1600)" << endl
+	     << "  -y <height>: the pixel height of the input images (default: from -t, else 1200)" << endl
+	     << "Keys:" << endl
+	     << "  space        freeze or resume the input to tune on one frame" << endl
+	     << "  q            quit" << endl
 ;
 }
 
 int main(int argc, char** argv) {
 
 	bool debug = false;
-	int cam = 0;
-	int height = 1200;
-	int width = 1600;
+	string input = "0";
+	source::Options sourceOpts;
+	int height = 0;
+	int width = 0;
+	int radii[2] = { 0, 0 };
+	string engineName;
+	string trackfile;
 	bool out = false;
 	string outfile;
+	string truthfile;
+	double msPerError = 10;
 	int c;
-	while ((c = getopt(argc, argv, "dhy:x:v:o:")) != -1) {
+	while ((c = getopt(argc, argv, "dhly:x:v:o:a:r:w:e:t:")) != -1) {
 		switch (c){
 		case 'd':
 			debug = true;
@@ -114,7 +512,34 @@ int main(int argc, char** argv) {
 			width = atoi(optarg);
 			break;
 		case 'v':
-			cam = atoi(optarg);
+			input = string(optarg);
+			break;
+		case 'l':
+			sourceOpts.loop = true;
+			break;
+		case 'a':
+			truthfile = string(optarg);
+			break;
+		case 'r':
+			if (sscanf(optarg, "%d,%d", &radii[0], &radii[1]) != 2) {
+				cout << "Invalid radius band: " << optarg << endl << endl;
+				help();
+				return 1;
+			}
+			break;
+		case 'w':
+			msPerError = atof(optarg);
+			break;
+		case 'e':
+			engineName = string(optarg);
+			if (engineName != "band" && engineName != "opencv") {
+				cout << "Unknown engine: " << optarg << endl << endl;
+				help();
+				return 1;
+			}
+			break;
+		case 't':
+			trackfile = string(optarg);
 			break;
 		case 'o':
 			out = true;
@@ -132,59 +557,89 @@ int main(int argc, char** argv) {
 		}
 	}
 
-    VideoCapture cap(cam);
+    // the base configuration seeds the trackbars, the options override it
+    if (!trackfile.empty()) {
+        if (!track::loadConfig(trackfile, &base)) {
+            cout << "Cannot read tracker configuration file: " << trackfile << endl;
+            return 1;
+        }
+        blurSize = base.blurSize;
+        blurSigma = cvRound(base.blurSigma * 10);
+        cannyThresh = cvRound(base.cannyThresh);
+        accThresh = cvRound(base.accThresh);
+        minRadius = base.minRadius;
+        maxRadius = base.maxRadius;
+        engine = base.engine;
+    } else {
+        base.width = 1600;
+        base.height = 1200;
+    }
+    if (width > 0)
+        base.width = width;
+    if (height > 0)
+        base.height = height;
+    width = base.width;
+    height = base.height;
+    if (radii[0] > 0 || radii[1] > 0) {
+        minRadius = radii[0];
+        maxRadius = radii[1];
+    }
+    if (!engineName.empty())
+        engine = engineName == "band" ? track::ENGINE_BAND : track::ENGINE_OPENCV;
+
+    if (!truthfile.empty())
+        return autoTune(truthfile, msPerError > 0 ? msPerError : 10, out, outfile);
+
+    sourceOpts.width = width;
+    sourceOpts.height = height;
+    source::FrameSource *cap = source::openSource(input, sourceOpts);
 
-    if (!cap.isOpened()) // check if we succeeded
+    if (cap == NULL) // check if we succeeded
     {
         cout << "Cannot initialize video capturing" << endl << endl;
         return -1;
     }
-    cap.set(CV_CAP_PROP_FRAME_WIDTH, width);
-    cap.set(CV_CAP_PROP_FRAME_HEIGHT, height);
-    cout << "Capture from camera" << endl;
+    cout << "Capture from " << input << endl;
 
     namedWindow("Circles", CV_WINDOW_NORMAL | CV_WINDOW_KEEPRATIO | CV_GUI_EXPANDED);
 
     Mat src;
 
-    createTrackbar("Display mode", "Circles", &mode, 2, onChange, &src);
-    createTrackbar("Blur Size", "Circles", &blurSize, 20, onChange, &src);
-    createTrackbar("Blur Sigma", "Circles", &blurSigma, 100, onChange, &src);
-    createTrackbar("Canny Thresh", "Circles", &cannyThresh, 500, onChange, &src);
-    createTrackbar("Min Radius", "Circles", &minRadius, 500, onChange, &src);
-    createTrackbar("Max Radius", "Circles", &maxRadius, 500, onChange, &src);
-    createTrackbar("Acc Thresh", "Circles", &accThresh, 200, onChange, &src);
+    createTrackbar("Display mode", "Circles", &mode, 2, onChange);
+    createTrackbar("Blur Size", "Circles", &blurSize, 20, onChange);
+    createTrackbar("Blur Sigma", "Circles", &blurSigma, 100, onChange);
+    createTrackbar("Canny Thresh", "Circles", &cannyThresh, 500, onChange);
+    createTrackbar("Min Radius", "Circles", &minRadius, 500, onChange);
+    createTrackbar("Max Radius", "Circles", &maxRadius, 500, onChange);
+    createTrackbar("Acc Thresh", "Circles", &accThresh, 200, onChange);
 
     int fps = 20;
     int period = 1000/fps;
-    while (cap.read(src)) {
-        processImage(src);
-        if (waitKey(period) == 'q')
+    bool frozen = false;
+    while (true) {
+        if (!frozen) {
+            if (!cap->read(src))
+                break;
+            cache.setFrame(src);
+            dirty = true;
+        }
+        if (dirty) {
+            dirty = false;
+            processImage(src);
+        }
+        int key = waitKey(period);
+        if (key == 'q')
             break;
+        if (key == ' ')
+            frozen = !frozen;
     }
+    delete cap;
 
-    if (out) {
-    	cout << "Writing settings to " << outfile << endl;
-		FileStorage fs(outfile, FileStorage::WRITE);
-		fs << "ImageHeightPx" << height;
-		fs << "ImageWidthPx" << width;
-		fs << "BlurSize" << blurSize;
-		fs << "BlurSigma" << (((double) blurSigma) / 10.0);
-		fs << "CannyThreshold" << cannyThresh;
-		fs << "MinRadius" << minRadius;
-		fs << "MaxRadius" << maxRadius;
-		fs << "AccumulatorThreshold" << accThresh;
-		fs.release();
-    } else {
-    	cout << "ImageHeightPx" << height << endl;
-    	cout << "ImageWidthPx" << width << endl;
-		cout << "BlurSize" << blurSize << endl;
-		cout << "BlurSigma" << (((double) blurSigma) / 10.0) << endl;
-		cout << "CannyThreshold" << cannyThresh << endl;
-		cout << "MinRadius" << minRadius << endl;
-		cout << "MaxRadius" << maxRadius << endl;
-		cout << "AccumulatorThreshold" << accThresh << endl;
-    }
+    track::Config conf = trackbarConfig(width, height);
+    if (out)
+        saveConfig(outfile, conf);
+    else
+        printConfig(conf);
 
     return 0;
 }